@@ -0,0 +1,250 @@
+// See the file "COPYING" for licence details.
+
+// Rate adjustment of a PCM audio stream to follow clock drift
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#include "audio_resampler.hpp"
+
+namespace
+{
+    // Buffer capacity, in frames.  This must allow for a target of
+    // more than a video frame's worth and for several frames being
+    // put at once.
+    const unsigned max_fill = 8 * PCM_PACKET_SIZE_MAX;
+    // Proportional gain for the fill level error, and the limit on
+    // the total rate adjustment (about 17 cents of pitch)
+    const double fill_gain = 0.005;
+    const double max_adjust = 0.01;
+    // Number of consecutive calls to get() with an empty buffer
+    // before we give up and let the caller produce silence
+    const unsigned max_starved_count = 3;
+}
+
+audio_resampler::audio_resampler()
+    : buffer_(PCM_CHANNELS * max_fill),
+      fill_(0),
+      position_(0),
+      mean_put_count_(0),
+      target_fill_(0),
+      starved_count_(0),
+      active_(false),
+      base_pos_(0),
+      next_put_serial_(0),
+      passed_through_(false),
+      passed_through_serial_(0)
+{
+    std::fill(last_, last_ + PCM_CHANNELS, 0);
+    for (unsigned i = 0; i != max_tracked_puts; ++i)
+	puts_[i].frame_count = 0;
+}
+
+void audio_resampler::reset(unsigned target_fill)
+{
+    assert(target_fill < max_fill);
+    fill_ = 0;
+    position_ = 0;
+    mean_put_count_ = 0;
+    target_fill_ = target_fill;
+    starved_count_ = 0;
+    active_ = false;
+    passed_through_ = false;
+    std::fill(last_, last_ + PCM_CHANNELS, 0);
+}
+
+unsigned audio_resampler::put(const pcm_sample * samples,
+			      unsigned frame_count)
+{
+    if (!active_)
+    {
+	// Prime with whole multiples of this frame count, so that
+	// reads of the same count line up with puts
+	fill_ = (target_fill_ + frame_count - 1) / frame_count * frame_count;
+	std::fill(buffer_.begin(), buffer_.begin() + PCM_CHANNELS * fill_, 0);
+	position_ = 0;
+	mean_put_count_ = frame_count;
+	starved_count_ = 0;
+	active_ = true;
+	for (unsigned i = 0; i != max_tracked_puts; ++i)
+	    puts_[i].frame_count = 0;
+    }
+
+    // Track the mean input frame count slowly, so that variation in
+    // individual counts does not modulate the rate
+    mean_put_count_ += (frame_count - mean_put_count_) / 64;
+
+    // If we are massively behind, drop the oldest frames
+    if (fill_ + frame_count > max_fill)
+    {
+	unsigned excess = fill_ + frame_count - max_fill;
+	std::memmove(&buffer_[0], &buffer_[PCM_CHANNELS * excess],
+		     PCM_CHANNELS * (fill_ - excess) * sizeof(pcm_sample));
+	fill_ -= excess;
+	base_pos_ += excess;
+    }
+
+    const unsigned serial = next_put_serial_++;
+    tracked_put & put = puts_[serial % max_tracked_puts];
+    put.serial = serial;
+    put.start = base_pos_ + fill_;
+    put.frame_count = frame_count;
+
+    std::memcpy(&buffer_[PCM_CHANNELS * fill_], samples,
+		PCM_CHANNELS * frame_count * sizeof(pcm_sample));
+    fill_ += frame_count;
+    return serial;
+}
+
+double audio_resampler::get_adjust(unsigned frame_count,
+				   double expected_count,
+				   int & pass_through_index) const
+{
+    pass_through_index = -1;
+
+    // Fill level error to be left after this read, if we read the
+    // expected number of frames
+    const double fill_error =
+	double(fill_) - expected_count - double(target_fill_);
+
+    if (std::fabs(fill_error) <= frame_count
+	&& std::fabs(expected_count - frame_count)
+	   <= max_adjust * frame_count)
+    {
+	// Look for a put starting at (or within half a frame of) the
+	// read position that can be read out unchanged, or else the
+	// put start nearest above the target fill level to steer the
+	// next read towards
+	const double read_pos = double(base_pos_) + position_;
+	double best_adjust = 0, best_error = 0;
+	bool found = false;
+
+	for (unsigned i = 0; i != max_tracked_puts; ++i)
+	{
+	    const tracked_put & put = puts_[i];
+	    if (put.frame_count == 0 || put.start < base_pos_)
+		continue;
+
+	    const double offset = double(put.start) - read_pos;
+	    if (std::fabs(offset) < 0.5 && fill_error >= 0
+		&& put.frame_count == frame_count
+		&& put.start + frame_count <= base_pos_ + fill_)
+	    {
+		pass_through_index = i;
+		return 0;
+	    }
+
+	    // Adjustment for the next read to start at this put, and
+	    // the fill level error that would result
+	    if (offset <= 0)
+		continue;
+	    const double adjust = offset / expected_count - 1;
+	    const double error = fill_error - expected_count * adjust;
+	    if (error >= 0 && error <= frame_count
+		&& (!found || error < best_error))
+	    {
+		best_adjust = adjust;
+		best_error = error;
+		found = true;
+	    }
+	}
+
+	if (found)
+	    return std::max(-max_adjust, std::min(max_adjust, best_adjust));
+    }
+
+    const double adjust = fill_gain * fill_error
+	/ double(target_fill_ ? target_fill_ : 1);
+    return std::max(-max_adjust, std::min(max_adjust, adjust));
+}
+
+bool audio_resampler::get(pcm_sample * samples, unsigned frame_count,
+			  double rate)
+{
+    passed_through_ = false;
+
+    if (!active_)
+	return false;
+
+    if (fill_ == 0 && ++starved_count_ > max_starved_count)
+    {
+	active_ = false;
+	return false;
+    }
+    if (fill_ != 0)
+	starved_count_ = 0;
+
+    // Input frames to consume per output frame.  The target applies
+    // to the fill level left after this read.
+    const double expected_count = mean_put_count_ * rate;
+    int pass_through_index;
+    const double adjust =
+	get_adjust(frame_count, expected_count, pass_through_index);
+
+    if (pass_through_index >= 0)
+    {
+	// Copy the put's frames, dropping any frame before it
+	const tracked_put & put = puts_[pass_through_index];
+	const unsigned index = unsigned(put.start - base_pos_);
+	std::copy(&buffer_[PCM_CHANNELS * index],
+		  &buffer_[PCM_CHANNELS * (index + frame_count)],
+		  samples);
+	std::copy(&samples[PCM_CHANNELS * (frame_count - 1)],
+		  &samples[PCM_CHANNELS * frame_count],
+		  last_);
+
+	const unsigned consumed = index + frame_count;
+	position_ = 0;
+	std::memmove(&buffer_[0], &buffer_[PCM_CHANNELS * consumed],
+		     PCM_CHANNELS * (fill_ - consumed) * sizeof(pcm_sample));
+	fill_ -= consumed;
+	base_pos_ += consumed;
+
+	passed_through_ = true;
+	passed_through_serial_ = put.serial;
+	return true;
+    }
+
+    const double step = expected_count * (1 + adjust) / frame_count;
+
+    double pos = position_;
+    for (unsigned i = 0; i != frame_count; ++i, pos += step)
+    {
+	unsigned index = unsigned(pos);
+	if (index + 1 < fill_)
+	{
+	    double frac = pos - index;
+	    const pcm_sample * a = &buffer_[PCM_CHANNELS * index];
+	    const pcm_sample * b = a + PCM_CHANNELS;
+	    for (unsigned c = 0; c != PCM_CHANNELS; ++c)
+		last_[c] = pcm_sample(a[c] + frac * (b[c] - a[c]));
+	}
+	else if (index < fill_)
+	{
+	    std::copy(&buffer_[PCM_CHANNELS * index],
+		      &buffer_[PCM_CHANNELS * (index + 1)],
+		      last_);
+	}
+	// else we have run out; hold the last sample
+	std::copy(last_, last_ + PCM_CHANNELS, samples + PCM_CHANNELS * i);
+    }
+
+    // Remove the frames we have passed over
+    unsigned consumed = std::min(unsigned(pos), fill_);
+    position_ = consumed < unsigned(pos) ? 0 : pos - consumed;
+    std::memmove(&buffer_[0], &buffer_[PCM_CHANNELS * consumed],
+		 PCM_CHANNELS * (fill_ - consumed) * sizeof(pcm_sample));
+    fill_ -= consumed;
+    base_pos_ += consumed;
+
+    return true;
+}
+
+bool audio_resampler::get_passed_through(unsigned & serial) const
+{
+    if (passed_through_)
+	serial = passed_through_serial_;
+    return passed_through_;
+}
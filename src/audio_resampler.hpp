@@ -0,0 +1,90 @@
+// See the file "COPYING" for licence details.
+
+// Rate adjustment of a PCM audio stream to follow clock drift
+
+#ifndef DVSWITCH_AUDIO_RESAMPLER_HPP
+#define DVSWITCH_AUDIO_RESAMPLER_HPP
+
+#include <vector>
+
+#include "pcm.h"
+
+// The resampler buffers a stream of PCM frames and reads them out at
+// a slightly adjustable rate, using linear interpolation, so that
+// the buffer stays close to a target fill level.  This lets audio
+// from a source whose clock drifts against ours be passed through
+// without dropping or repeating whole video frames' worth of
+// samples.  A short gap in the input is covered by the buffered
+// samples and then by holding the last sample, rather than by
+// silence.
+//
+// When the fill level is near the target and the input and output
+// rates are about the same, the read position is instead steered to
+// the start of a put(), so that whole puts can be read out unchanged
+// and the caller can pass their original encoding through.
+
+class audio_resampler
+{
+public:
+    // Number of recent calls to put() that are tracked for
+    // pass-through
+    static const unsigned max_tracked_puts = 8;
+
+    audio_resampler();
+
+    // Discard buffered samples.  On the next put() the buffer will be
+    // primed with at least target_fill frames of silence.
+    void reset(unsigned target_fill);
+
+    // Append frames to the buffer.  Return a serial number for them,
+    // which get_passed_through() may report later.
+    unsigned put(const pcm_sample * samples, unsigned frame_count);
+
+    // Read frames from the buffer.  rate is the expected number of
+    // input frames per call, relative to the mean of frame counts
+    // passed to put(); this is adjusted up or down to steer the
+    // buffer towards the target fill level.  Return false, without
+    // reading anything, if the resampler has no input to follow.
+    bool get(pcm_sample * samples, unsigned frame_count, double rate);
+
+    // If the last call to get() read exactly the frames of one call
+    // to put(), without interpolation or rate adjustment, return true
+    // and set serial to that put()'s serial number.
+    bool get_passed_through(unsigned & serial) const;
+
+    // Number of frames buffered
+    unsigned fill() const { return fill_; }
+
+private:
+    struct tracked_put
+    {
+	unsigned serial;
+	unsigned long long start;
+	unsigned frame_count;
+    };
+
+    // Choose a rate adjustment for get(), or find a put to pass
+    // through and return its index in puts_
+    double get_adjust(unsigned frame_count, double expected_count,
+		      int & pass_through_index) const;
+
+    std::vector<pcm_sample> buffer_;
+    unsigned fill_;
+    double position_;
+    double mean_put_count_;
+    unsigned target_fill_;
+    unsigned starved_count_;
+    bool active_;
+    pcm_sample last_[PCM_CHANNELS];
+    // Position of buffer_[0] in the stream of all frames buffered,
+    // including the initial silence and any frames dropped
+    unsigned long long base_pos_;
+    // The last max_tracked_puts puts, indexed by serial number
+    // modulo max_tracked_puts.  frame_count is 0 for unused entries.
+    tracked_put puts_[max_tracked_puts];
+    unsigned next_put_serial_;
+    bool passed_through_;
+    unsigned passed_through_serial_;
+};
+
+#endif // !DVSWITCH_AUDIO_RESAMPLER_HPP
@@ -3,6 +3,9 @@
 
 // DIF definitions and metadata access
 
+#include <stdbool.h>
+#include <string.h>
+
 #include "dif.h"
 
 static const uint8_t dv_audio_shuffle_625_50[12][9] = {
@@ -134,3 +137,113 @@ enum dv_sample_rate dv_buffer_get_sample_rate(const uint8_t * buffer)
 
     return dv_sample_rate_invalid;
 }
+
+// Find the area covered by macroblock m of video segment slot in DIF
+// sequence seq.  This follows the shuffling pattern of IEC 61834-2
+// and SMPTE 314M for 25 Mbit/s DV.
+static void dv_get_macroblock_rect(const struct dv_system * system,
+				   bool is_420, unsigned seq, unsigned slot,
+				   unsigned m, struct rectangle * rect)
+{
+    // Offsets of the sequence used for each macroblock of a segment
+    static const uint8_t seq_off[5] = { 2, 6, 8, 0, 4 };
+    // Starting columns (in macroblocks) for each macroblock of a
+    // segment
+    static const uint8_t col_start_420[5] = { 18, 9, 27, 0, 36 };
+    static const uint8_t col_start_411[5] = { 9, 4, 13, 0, 18 };
+    // Rows (in macroblocks) visited within a super block
+    static const uint8_t serpent_420[27] = {
+	0, 1, 2, 2, 1, 0, 0, 1, 2, 2, 1, 0, 0, 1, 2, 2, 1, 0,
+	0, 1, 2, 2, 1, 0, 0, 1, 2
+    };
+    static const uint8_t serpent_411[30] = {
+	0, 1, 2, 3, 4, 5, 5, 4, 3, 2, 1, 0, 0, 1, 2, 3, 4, 5,
+	5, 4, 3, 2, 1, 0, 0, 1, 2, 3, 4, 5
+    };
+
+    unsigned super_row = (seq + seq_off[m]) % system->seq_count;
+
+    if (is_420)
+    {
+	// 16x16 macroblocks
+	rect->left = (col_start_420[m] + slot / 3) * 16;
+	rect->top = (serpent_420[slot] + super_row * 3) * 16;
+	rect->right = rect->left + 16;
+	rect->bottom = rect->top + 16;
+    }
+    else
+    {
+	// 32x8 macroblocks, except for 16x16 macroblocks in the
+	// rightmost column
+	unsigned k = slot + ((m == 1 || m == 2) ? 3 : 0);
+	unsigned col = col_start_411[m] + k / 6;
+	unsigned row = serpent_411[k] + super_row * 6;
+	if (col > 21)
+	{
+	    rect->left = col * 32;
+	    rect->top = (row * 2 - super_row * 6) * 8;
+	    rect->right = rect->left + 16;
+	    rect->bottom = rect->top + 16;
+	}
+	else
+	{
+	    rect->left = col * 32;
+	    rect->top = row * 8;
+	    rect->right = rect->left + 32;
+	    rect->bottom = rect->top + 8;
+	}
+    }
+}
+
+void dv_buffer_copy_video_outside(uint8_t * dest, const uint8_t * source,
+				  const struct rectangle * rect)
+{
+    const struct dv_system * system = dv_buffer_system(source);
+    // 625/50 lines uses 4:2:0 sampling unless the application ID
+    // says this is SMPTE 314M, which always uses 4:1:1 sampling
+    bool is_420 = system == &dv_system_625_50 && (source[4] & 7) == 0;
+    unsigned seq, slot, m;
+
+    for (seq = 0; seq != system->seq_count; ++seq)
+    {
+	for (slot = 0; slot != 27; ++slot)
+	{
+	    bool changed = false;
+
+	    for (m = 0; m != 5 && !changed; ++m)
+	    {
+		struct rectangle mb_rect;
+		dv_get_macroblock_rect(system, is_420, seq, slot, m, &mb_rect);
+		rectangle_clip(&mb_rect, rect);
+		changed = !rectangle_is_empty(&mb_rect);
+	    }
+
+	    if (!changed)
+	    {
+		// Video blocks follow each audio block in groups of 15
+		size_t offset = (seq * DIF_SEQUENCE_SIZE
+				 + (7 + slot * 5 + slot / 3) * DIF_BLOCK_SIZE);
+		memcpy(dest + offset, source + offset, 5 * DIF_BLOCK_SIZE);
+	    }
+	}
+    }
+}
+
+void dv_buffer_copy_non_video(uint8_t * dest, const uint8_t * source)
+{
+    const struct dv_system * system = dv_buffer_system(source);
+    unsigned seq, block_num;
+
+    for (seq = 0; seq != system->seq_count; ++seq)
+    {
+	size_t seq_offset = seq * DIF_SEQUENCE_SIZE;
+	// Header, subcode, VAUX and first audio block
+	memcpy(dest + seq_offset, source + seq_offset, 7 * DIF_BLOCK_SIZE);
+	// Remaining audio blocks, each followed by 15 video blocks
+	for (block_num = 1; block_num != 9; ++block_num)
+	{
+	    size_t offset = seq_offset + (6 + block_num * 16) * DIF_BLOCK_SIZE;
+	    memcpy(dest + offset, source + offset, DIF_BLOCK_SIZE);
+	}
+    }
+}
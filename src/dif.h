@@ -6,6 +6,7 @@
 #ifndef DVSWITCH_DIF_H
 #define DVSWITCH_DIF_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -113,13 +114,35 @@ void dv_buffer_set_audio(uint8_t * buffer,
 			 enum dv_sample_rate sample_rate_code,
 			 unsigned frame_count, const dvs_pcm_sample_t * samples);
 
-void dv_buffer_get_audio_levels(const uint8_t * frame, int * levels);
+// Audio levels for each channel in dB relative to full scale, or
+// INT_MIN for digital silence
+struct dv_audio_levels
+{
+    int rms[PCM_CHANNELS];
+    int peak[PCM_CHANNELS];
+};
+
+void dv_get_audio_levels(const pcm_sample * samples, unsigned frame_count,
+			 struct dv_audio_levels * levels);
+// Get audio levels from buffer.  Return false if it has no valid audio.
+bool dv_buffer_get_audio_levels(const uint8_t * buffer,
+				struct dv_audio_levels * levels);
 void dv_buffer_dub_audio(uint8_t * dest, const uint8_t * source);
 void dv_buffer_silence_audio(uint8_t * buffer,
 			     enum dv_sample_rate sample_rate_code,
 			     unsigned serial_num);
 void dv_buffer_fill_dummy(uint8_t * buf, const struct dv_system * system);
 
+// Copy the video segments of source to dest, except for those that
+// include any macroblock intersecting the given rectangle.  Video
+// segments are coded independently, so this can be used to combine
+// frames.  Both buffers must use the same video system and sampling.
+void dv_buffer_copy_video_outside(uint8_t * dest, const uint8_t * source,
+				  const struct rectangle * rect);
+
+// Copy all blocks of source to dest except the video blocks
+void dv_buffer_copy_non_video(uint8_t * dest, const uint8_t * source);
+
 #ifdef __cplusplus
 }
 #endif
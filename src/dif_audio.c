@@ -6,8 +6,12 @@
 #include <assert.h>
 #include <limits.h>
 #include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include <pthread.h>
+
 #include "dif.h"
 
 // Samples may be encoded as either 16-bit LPCM or 12-bit companded PCM.
@@ -77,22 +81,95 @@ static pcm_sample decode_12bit(unsigned code)
     }
 }
 
-unsigned dv_buffer_get_audio(const uint8_t * buffer, pcm_sample * samples)
+static unsigned encode_12bit(pcm_sample sample)
 {
-    const struct dv_system * system = dv_buffer_system(buffer);
-    const uint8_t * as_pack = buffer + (6 + 3 * 16) * DIF_BLOCK_SIZE + 3;
+    if (sample >= -0x200 && sample <= 0x200)
+    {
+	return (unsigned)sample & 0xfff;
+    }
+    else if (sample > 0)
+    {
+	unsigned scale = get_12bit_scale(sample);
+	return ((scale + 1) << 8) | ((sample >> scale) & 0xff);
+    }
+    else
+    {
+	unsigned scale = get_12bit_scale(~sample);
+	return ((14 - scale) << 8) | ((((sample - 1) >> scale) + 1) & 0xff);
+    }
+}
 
-    enum dv_sample_rate sample_rate_code = dv_buffer_get_sample_rate(buffer);
-    if (sample_rate_code < 0)
-	return 0;
+// Companding and expanding are done through tables, built on first
+// use, since the range tests above are too slow to do per sample.
 
-    unsigned quant = as_pack[4] & 7;
-    if (quant > 1)
-	return 0;
+static pcm_sample decode_12bit_table[1 << 12];
+static uint16_t encode_12bit_table[1 << 16];
+static pthread_once_t companding_tables_once = PTHREAD_ONCE_INIT;
 
-    unsigned sample_count =
-	PCM_CHANNELS * (system->audio_frame_counts[sample_rate_code].min +
-			(as_pack[1] & 0x3f));
+static void build_companding_tables(void)
+{
+    for (unsigned code = 0; code != 1 << 12; ++code)
+	decode_12bit_table[code] = decode_12bit(code);
+    for (unsigned sample = 0; sample != 1 << 16; ++sample)
+	encode_12bit_table[sample] = encode_12bit((pcm_sample)sample);
+}
+
+// Expand 12-bit codes to 16-bit samples
+static void decode_12bit_samples(pcm_sample * samples, const uint16_t * codes,
+				 unsigned count)
+{
+    pthread_once(&companding_tables_once, build_companding_tables);
+    for (unsigned i = 0; i != count; ++i)
+	samples[i] = decode_12bit_table[codes[i] & 0xfff];
+}
+
+// Compand 16-bit samples to 12-bit codes.  The samples may be
+// converted in place.
+static void encode_12bit_samples(uint16_t * codes, const uint16_t * samples,
+				 unsigned count)
+{
+    pthread_once(&companding_tables_once, build_companding_tables);
+    for (unsigned i = 0; i != count; ++i)
+	codes[i] = encode_12bit_table[samples[i]];
+}
+
+// Audio samples are shuffled across the DIF sequences and blocks of a
+// frame.  Rather than working out the shuffle for every sample, we
+// build tables for each video system and quantisation mapping in both
+// directions between sample positions and byte offsets.
+
+// Maximum number of sample positions in a frame (for 625/50 16-bit)
+#define AUDIO_MAP_MAX_SAMPLES (12 * 9 * 36)
+
+struct audio_map
+{
+    // Number of sample positions
+    unsigned sample_count;
+    // For each sample position, the offset of its most significant
+    // byte in the frame
+    uint32_t offset[AUDIO_MAP_MAX_SAMPLES];
+    // For 12-bit quantisation, the shift to extract the sample's
+    // least significant 4 bits from the third byte of its group.
+    // This is 4 for the first sample of a group and 0 for the second,
+    // so that byte is at offset + 1 + shift / 4.
+    uint8_t lo_shift[AUDIO_MAP_MAX_SAMPLES];
+    // Sample positions in the order they appear in the frame, for
+    // the sequences and blocks that carry the first 2 channels
+    uint16_t slot_pos[AUDIO_MAP_MAX_SAMPLES];
+};
+
+// Indexed by system code and quantisation
+static struct audio_map audio_maps[2][2];
+static pthread_once_t audio_maps_once = PTHREAD_ONCE_INIT;
+
+static void build_audio_map(struct audio_map * map,
+			    const struct dv_system * system, unsigned quant)
+{
+    unsigned samples_per_block = quant ? 24 : 36;
+    unsigned slot = 0;
+
+    map->sample_count = system->seq_count * 9 * samples_per_block;
+    assert(map->sample_count <= AUDIO_MAP_MAX_SAMPLES);
 
     for (unsigned seq = 0;
 	 seq != (quant ? system->seq_count / 2 : system->seq_count);
@@ -100,105 +177,146 @@ unsigned dv_buffer_get_audio(const uint8_t * buffer, pcm_sample * samples)
     {
 	for (unsigned block_n = 0; block_n != 9; ++block_n)
 	{
-	    const uint8_t * block =
-		&buffer[seq * DIF_SEQUENCE_SIZE +
-			(6 + 16 * block_n) * DIF_BLOCK_SIZE];
+	    uint32_t block_offset = (seq * DIF_SEQUENCE_SIZE +
+				     (6 + 16 * block_n) * DIF_BLOCK_SIZE + 8);
 
-	    if (quant) // 12-bit
+	    for (unsigned i = 0; i != samples_per_block; ++i)
 	    {
-		for (unsigned i = 0; i != 24; ++i)
+		unsigned pos = (system->audio_shuffle[seq][block_n] +
+				i * system->seq_count * 9);
+
+		if (quant) // 12-bit
 		{
-		    unsigned pos = (system->audio_shuffle[seq][block_n] +
-				    i * system->seq_count * 9);
-		    if (pos < sample_count)
-		    {
-			unsigned code = ((block[8 + 3 * i] << 4) +
-					 (block[8 + 3 * i + 2] >> 4));
-			samples[pos] = decode_12bit(code);
-		    }
-
-		    pos = (system->audio_shuffle[
-			       seq + system->seq_count / 2][block_n] +
-			   i * system->seq_count * 9);
-		    if (pos < sample_count)
-		    {
-			unsigned code = ((block[8 + 3 * i + 1] << 4) +
-					  (block[8 + 3 * i + 2] & 0xf));
-			samples[pos] = decode_12bit(code);
-		    }
+		    unsigned pos2 = (system->audio_shuffle[
+					 seq + system->seq_count / 2][block_n] +
+				     i * system->seq_count * 9);
+
+		    map->offset[pos] = block_offset + 3 * i;
+		    map->lo_shift[pos] = 4;
+		    map->offset[pos2] = block_offset + 3 * i + 1;
+		    map->lo_shift[pos2] = 0;
+		    map->slot_pos[slot++] = pos;
+		    map->slot_pos[slot++] = pos2;
 		}
-	    }
-	    else // 16-bit
-	    {
-		for (unsigned i = 0; i != 36; ++i)
+		else // 16-bit
 		{
-		    unsigned pos = (system->audio_shuffle[seq][block_n] +
-				    i * system->seq_count * 9);
-		    if (pos < sample_count)
-		    {
-			pcm_sample sample = (block[8 + 2 * i + 1] +
-					     (block[8 + 2 * i] << 8));
-			if (sample == -0x8000)
-			    sample = 0;
-			samples[pos] = sample;
-		    }
+		    map->offset[pos] = block_offset + 2 * i;
+		    map->lo_shift[pos] = 0;
+		    map->slot_pos[slot++] = pos;
 		}
 	    }
 	}
     }
 
-    return sample_count / PCM_CHANNELS;
+    assert(slot == map->sample_count);
 }
 
-void dv_buffer_get_audio_levels(const uint8_t * buffer, int * levels)
+static void build_audio_maps(void)
 {
-    pcm_sample samples[PCM_CHANNELS * 2000];
-    unsigned frame_count = dv_buffer_get_audio(buffer, samples);
+    for (unsigned quant = 0; quant != 2; ++quant)
+    {
+	build_audio_map(&audio_maps[0][quant], &dv_system_525_60, quant);
+	build_audio_map(&audio_maps[1][quant], &dv_system_625_50, quant);
+    }
+}
 
-    assert(PCM_CHANNELS * frame_count * sizeof(pcm_sample) <= sizeof(samples));
+static const struct audio_map * get_audio_map(const uint8_t * buffer,
+					      unsigned quant)
+{
+    pthread_once(&audio_maps_once, build_audio_maps);
+    return &audio_maps[dv_buffer_system_code(buffer)][quant];
+}
+
+unsigned dv_buffer_get_audio(const uint8_t * buffer, pcm_sample * samples)
+{
+    const struct dv_system * system = dv_buffer_system(buffer);
+    const uint8_t * as_pack = buffer + (6 + 3 * 16) * DIF_BLOCK_SIZE + 3;
 
-    // Total of squares of samples, so we can calculate average power.  We shift
-    // right to avoid overflow.
-    static const unsigned total_shift = 9;
-    unsigned total_l = 0, total_r = 0;
+    enum dv_sample_rate sample_rate_code = dv_buffer_get_sample_rate(buffer);
+    if (sample_rate_code < 0)
+	return 0;
 
-    for (unsigned i = 0; i != frame_count; ++i)
+    unsigned quant = as_pack[4] & 7;
+    if (quant > 1)
+	return 0;
+
+    const struct audio_map * map = get_audio_map(buffer, quant);
+    unsigned sample_count =
+	PCM_CHANNELS * (system->audio_frame_counts[sample_rate_code].min +
+			(as_pack[1] & 0x3f));
+    if (sample_count > map->sample_count)
+	sample_count = map->sample_count;
+
+    if (quant) // 12-bit
     {
-	pcm_sample sample = samples[PCM_CHANNELS * i];
-	total_l += ((unsigned)(sample * sample)) >> total_shift;
-	sample = samples[PCM_CHANNELS * i + 1];
-	total_r += ((unsigned)(sample * sample)) >> total_shift;
+	uint16_t codes[AUDIO_MAP_MAX_SAMPLES];
+	for (unsigned pos = 0; pos != sample_count; ++pos)
+	{
+	    const uint8_t * p = buffer + map->offset[pos];
+	    unsigned shift = map->lo_shift[pos];
+	    codes[pos] = (p[0] << 4) + ((p[1 + shift / 4] >> shift) & 0xf);
+	}
+	decode_12bit_samples(samples, codes, sample_count);
+    }
+    else // 16-bit
+    {
+	for (unsigned pos = 0; pos != sample_count; ++pos)
+	{
+	    const uint8_t * p = buffer + map->offset[pos];
+	    pcm_sample sample = (p[0] << 8) + p[1];
+	    samples[pos] = (sample == -0x8000) ? 0 : sample;
+	}
     }
 
-    // Calculate average power and convert to dB
-    levels[0] = (total_l == 0 ? INT_MIN
-		 : (int)(log10((double)total_l * (1 << total_shift) /
-			       ((double)frame_count * (0x7fff * 0x7fff)))
-			 * 10.0));
-    levels[1] = (total_r == 0 ? INT_MIN
-		 : (int)(log10((double)total_r * (1 << total_shift) /
-			       ((double)frame_count * (0x7fff * 0x7fff)))
-			 * 10.0));
+    return sample_count / PCM_CHANNELS;
 }
 
-static unsigned encode_12bit(pcm_sample sample)
+void dv_get_audio_levels(const pcm_sample * samples, unsigned frame_count,
+			 struct dv_audio_levels * levels)
 {
-    if (sample >= -0x200 && sample <= 0x200)
-    {
-	return (unsigned)sample & 0xfff;
-    }
-    else if (sample > 0)
+    // Total of squares of samples, so we can calculate average power,
+    // and maximum magnitude
+    uint64_t total[PCM_CHANNELS] = { 0 };
+    unsigned peak[PCM_CHANNELS] = { 0 };
+
+    for (unsigned i = 0; i != frame_count; ++i)
     {
-	unsigned scale = get_12bit_scale(sample);
-	return ((scale + 1) << 8) | ((sample >> scale) & 0xff);
+	for (unsigned channel = 0; channel != PCM_CHANNELS; ++channel)
+	{
+	    int sample = samples[PCM_CHANNELS * i + channel];
+	    unsigned magnitude = (sample < 0) ? -sample : sample;
+	    total[channel] += magnitude * magnitude;
+	    if (magnitude > peak[channel])
+		peak[channel] = magnitude;
+	}
     }
-    else
+
+    // Convert average power and peak to dB
+    for (unsigned channel = 0; channel != PCM_CHANNELS; ++channel)
     {
-	unsigned scale = get_12bit_scale(~sample);
-	return ((14 - scale) << 8) | ((((sample - 1) >> scale) + 1) & 0xff);
+	levels->rms[channel] =
+	    (total[channel] == 0 ? INT_MIN
+	     : (int)(log10((double)total[channel] /
+			   ((double)frame_count * (0x7fff * 0x7fff)))
+		     * 10.0));
+	levels->peak[channel] =
+	    (peak[channel] == 0 ? INT_MIN
+	     : (int)(log10((double)peak[channel] / 0x7fff) * 20.0));
     }
 }
 
+bool dv_buffer_get_audio_levels(const uint8_t * buffer,
+				struct dv_audio_levels * levels)
+{
+    pcm_sample samples[AUDIO_MAP_MAX_SAMPLES];
+    unsigned frame_count = dv_buffer_get_audio(buffer, samples);
+
+    if (frame_count == 0)
+	return false;
+    dv_get_audio_levels(samples, frame_count, levels);
+    return true;
+}
+
 void dv_buffer_dub_audio(uint8_t * dest, const uint8_t * source)
 {
     const struct dv_system * system = dv_buffer_system(dest);
@@ -267,10 +385,10 @@ void dv_buffer_set_audio(uint8_t * buffer,
 	// bit 7: ?
 	dv_buffer_system_code(buffer) << 5,
 	// bits 0-2: quantisation; 0 for 16-bit LPCM, 1 for 12-bit
-	// bits 3-5: sample rate code
+	// bits 3-5: sample rate code; 0 for 48 kHz, 2 for 32 kHz
 	// bit 6: time constant of emphasis; must be 1
 	// bit 7: flag for no emphasis
-	use_12bit | (sample_rate_code << 3) | (1 << 6) | (1 << 7)
+	use_12bit | ((use_12bit ? 2 : 0) << 3) | (1 << 6) | (1 << 7)
     };
     static const uint8_t aaux_asc_pack[DIF_PACK_SIZE] = {
 	// pack id; 0x51 for AAUX source control
@@ -293,6 +411,24 @@ void dv_buffer_set_audio(uint8_t * buffer,
 	0x7F
     };
 
+    // Copy (and encode) the samples into a buffer indexed by sample
+    // position, with silence after the last sample, so that the
+    // blocks can be filled without checking bounds
+    const struct audio_map * map = get_audio_map(buffer, use_12bit);
+    uint16_t codes[AUDIO_MAP_MAX_SAMPLES];
+    if (samples)
+    {
+	assert(sample_count <= map->sample_count);
+	for (unsigned pos = 0; pos != sample_count; ++pos)
+	    codes[pos] = (uint16_t)DV_PCM_CONVERT_TO_S16(samples[pos]);
+	if (use_12bit)
+	    encode_12bit_samples(codes, codes, sample_count);
+	memset(codes + sample_count, 0,
+	       (map->sample_count - sample_count) * sizeof(codes[0]));
+    }
+
+    const uint16_t * slot_pos = map->slot_pos;
+
     for (unsigned seq = 0; seq != system->seq_count; ++seq)
     {
 	if (use_12bit && seq == system->seq_count / 2)
@@ -322,37 +458,77 @@ void dv_buffer_set_audio(uint8_t * buffer,
 	    {
 		for (unsigned i = 0; i != 24; ++i)
 		{
-		    unsigned pos = (system->audio_shuffle[seq][block_n] +
-				    i * system->seq_count * 9);
-		    unsigned code1 =
-			(pos < sample_count) ? encode_12bit(DV_PCM_CONVERT_TO_S16(samples[pos])) : 0;
-		    pos = (system->audio_shuffle[
-			       seq + system->seq_count / 2][block_n] +
-			   i * system->seq_count * 9);
-		    unsigned code2 =
-			(pos < sample_count) ? encode_12bit(DV_PCM_CONVERT_TO_S16(samples[pos])) : 0;
-
-		    *out++ = code1 >> 4;
-		    *out++ = code2 >> 4;
-		    *out++ = (code1 << 4) | (code2 & 0xf);
+		    unsigned code1 = codes[slot_pos[2 * i]];
+		    unsigned code2 = codes[slot_pos[2 * i + 1]];
+		    out[3 * i] = code1 >> 4;
+		    out[3 * i + 1] = code2 >> 4;
+		    out[3 * i + 2] = (code1 << 4) | (code2 & 0xf);
 		}
+		slot_pos += 48;
 	    }
 	    else // 16-bit
 	    {
 		for (unsigned i = 0; i != 36; ++i)
 		{
-		    unsigned pos = (system->audio_shuffle[seq][block_n] +
-				    i * system->seq_count * 9);
-		    pcm_sample sample = (pos < sample_count) ? DV_PCM_CONVERT_TO_S16(samples[pos]) : 0;
-
-		    *out++ = sample >> 8;
-		    *out++ = sample & 0xff;
+		    unsigned sample = codes[slot_pos[i]];
+		    out[2 * i] = sample >> 8;
+		    out[2 * i + 1] = sample & 0xff;
 		}
+		slot_pos += 36;
 	    }
 	}
     }
 }
 
+// Silent audio blocks (without block ids) for each system and sample
+// rate, with the AS packs set for the minimum sample count.  Silence
+// can then be written with block copies and a patch to the AS packs.
+struct silence_template
+{
+    uint8_t blocks[12 * 9][DIF_BLOCK_SIZE - DIF_BLOCK_ID_SIZE];
+};
+
+// Indexed by system code and sample rate code
+static struct silence_template silence_templates[2][dv_sample_rate_count];
+static pthread_once_t silence_templates_once = PTHREAD_ONCE_INIT;
+
+static void build_silence_templates(void)
+{
+    uint8_t * scratch = malloc(DIF_MAX_FRAME_SIZE);
+    if (scratch == NULL)
+    {
+	perror("ERROR: malloc");
+	exit(1);
+    }
+
+    for (unsigned system_code = 0; system_code != 2; ++system_code)
+    {
+	const struct dv_system * system =
+	    system_code ? &dv_system_625_50 : &dv_system_525_60;
+
+	dv_buffer_fill_dummy(scratch, system);
+	assert(dv_buffer_system_code(scratch) == system_code);
+
+	for (unsigned rate = 0; rate != dv_sample_rate_count; ++rate)
+	{
+	    struct silence_template * tmpl =
+		&silence_templates[system_code][rate];
+
+	    dv_buffer_set_audio(scratch, rate,
+				system->audio_frame_counts[rate].min, NULL);
+	    for (unsigned seq = 0; seq != system->seq_count; ++seq)
+		for (unsigned block_n = 0; block_n != 9; ++block_n)
+		    memcpy(tmpl->blocks[seq * 9 + block_n],
+			   scratch + seq * DIF_SEQUENCE_SIZE +
+			   (6 + 16 * block_n) * DIF_BLOCK_SIZE +
+			   DIF_BLOCK_ID_SIZE,
+			   DIF_BLOCK_SIZE - DIF_BLOCK_ID_SIZE);
+	}
+    }
+
+    free(scratch);
+}
+
 void dv_buffer_silence_audio(uint8_t * buffer,
 			     enum dv_sample_rate sample_rate_code,
 			     unsigned serial_num)
@@ -363,7 +539,31 @@ void dv_buffer_silence_audio(uint8_t * buffer,
 	    serial_num %
 	    system->audio_frame_counts[sample_rate_code].std_cycle_len];
 
-    dv_buffer_set_audio(buffer, sample_rate_code, frame_count, NULL);
+    assert(sample_rate_code >= 0 && sample_rate_code < dv_sample_rate_count);
+
+    pthread_once(&silence_templates_once, build_silence_templates);
+    const struct silence_template * tmpl =
+	&silence_templates[dv_buffer_system_code(buffer)][sample_rate_code];
+
+    // Sample count field of the AS pack (see dv_buffer_set_audio)
+    uint8_t count_code =
+	(frame_count - system->audio_frame_counts[sample_rate_code].min)
+	| (1 << 6) | (1 << 7);
+
+    for (unsigned seq = 0; seq != system->seq_count; ++seq)
+    {
+	uint8_t * seq_buffer = buffer + seq * DIF_SEQUENCE_SIZE;
+
+	for (unsigned block_n = 0; block_n != 9; ++block_n)
+	    memcpy(seq_buffer + (6 + 16 * block_n) * DIF_BLOCK_SIZE +
+		   DIF_BLOCK_ID_SIZE,
+		   tmpl->blocks[seq * 9 + block_n],
+		   DIF_BLOCK_SIZE - DIF_BLOCK_ID_SIZE);
+
+	unsigned as_block_n = (seq & 1) ? 0 : 3;
+	seq_buffer[(6 + 16 * as_block_n) * DIF_BLOCK_SIZE +
+		   DIF_BLOCK_ID_SIZE + 1] = count_code;
+    }
 }
 
 void dv_buffer_fill_dummy(uint8_t * buf, const struct dv_system * system)
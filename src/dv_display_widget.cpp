@@ -199,7 +199,8 @@ void dv_display_widget::put_frame(const dv_frame_ptr & dv_frame)
     }
 }
 
-void dv_display_widget::put_frame(const raw_frame_ptr & raw_frame)
+void dv_display_widget::put_frame(const raw_frame_ptr & raw_frame,
+				  bool format_error)
 {
     if (!is_realized())
 	return;
@@ -228,6 +229,7 @@ void dv_display_widget::put_frame(const raw_frame_ptr & raw_frame)
 	decoded_serial_num_ = raw_frame->header.pts;
 
 	put_frame_buffer(get_display_region(system, raw_frame->aspect));
+	set_error(format_error);
 	queue_draw();
     }
 }
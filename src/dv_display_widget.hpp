@@ -21,7 +21,9 @@ class dv_display_widget : public Gtk::DrawingArea
 {
 public:
     void put_frame(const dv_frame_ptr &);
-    void put_frame(const raw_frame_ptr &);
+    // A raw frame has no format_error flag, so the caller passes
+    // that of the DV frame it was decoded from
+    void put_frame(const raw_frame_ptr &, bool format_error = false);
 
 protected:
     struct display_region : rectangle
@@ -19,6 +19,7 @@ namespace
     enum {
 	column_labels,
 	column_display,
+	column_meter,
 	column_separator,
 	column_multiplier
     };
@@ -78,6 +79,7 @@ void dv_selector_widget::set_source_count(unsigned count)
 	try
 	{
 	    thumbnails_.resize(count);
+	    meters_.resize(count);
 	    pri_btn_.resize(count);
 	    sec_btn_.resize(count);
 	    snd_btn_.resize(count);
@@ -108,6 +110,16 @@ void dv_selector_widget::set_source_count(unsigned count)
 		       0, 0);
 		thumbnails_[i] = thumb;
 
+		vu_meter * meter = manage(new vu_meter(-56, 0));
+		meter->set_size_request(48, -1);
+		meter->show();
+		attach(*meter,
+		       column + column_meter, column + column_meter + 1,
+		       row, row + row_multiplier,
+		       Gtk::FILL, Gtk::FILL,
+		       0, 0);
+		meters_[i] = meter;
+
 		char label_text[4];
 		snprintf(label_text, sizeof(label_text),
 			 (i < 9) ? "_%u" : "%u", unsigned(1 + i));
@@ -225,6 +237,7 @@ void dv_selector_widget::set_source_count(unsigned count)
 	{
 	    // Roll back size changes
 	    thumbnails_.resize(first_new_source_id);
+	    meters_.resize(first_new_source_id);
 	    std::cerr << "ERROR: Failed to add source display: " << e.what()
 		      << "\n";
 	}
@@ -238,6 +251,28 @@ void dv_selector_widget::put_frame(mixer::source_id source_id,
 	thumbnails_[source_id]->put_frame(source_frame);
 }
 
+void dv_selector_widget::put_frame(mixer::source_id source_id,
+				   const raw_frame_ptr & source_frame,
+				   bool format_error)
+{
+    if (source_id < thumbnails_.size())
+	thumbnails_[source_id]->put_frame(source_frame, format_error);
+}
+
+void dv_selector_widget::set_audio_levels(mixer::source_id source_id,
+					  const int * levels)
+{
+    if (source_id < meters_.size())
+	meters_[source_id]->set_levels(levels);
+}
+
+void dv_selector_widget::set_source_tooltip(mixer::source_id source_id,
+					    const Glib::ustring & text)
+{
+    if (source_id < thumbnails_.size())
+	thumbnails_[source_id]->set_tooltip_text(text);
+}
+
 void dv_selector_widget::select_pri(mixer::source_id id)
 {
     if (id >= pri_btn_.size())
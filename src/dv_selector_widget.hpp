@@ -15,6 +15,7 @@
 
 #include "dv_display_widget.hpp"
 #include "mixer.hpp"
+#include "vu_meter.hpp"
 
 class dv_selector_widget : public Gtk::Table
 {
@@ -26,6 +27,11 @@ public:
     void set_source_count(unsigned);
     void put_frame(mixer::source_id source_id,
 		   const dv_frame_ptr & source_frame);
+    void put_frame(mixer::source_id source_id,
+		   const raw_frame_ptr & source_frame, bool format_error);
+    void set_audio_levels(mixer::source_id source_id, const int * levels);
+    void set_source_tooltip(mixer::source_id source_id,
+			    const Glib::ustring & text);
 
     void select_pri(mixer::source_id source_id);
     void select_sec(mixer::source_id source_id);
@@ -54,6 +60,7 @@ private:
     Gtk::RadioButtonGroup audio_button_group_;
     sigc::signal1<void, mixer::source_id> audio_selected_signal_;
     std::vector<dv_thumb_display_widget *> thumbnails_;
+    std::vector<vu_meter *> meters_;
     std::vector<Gtk::RadioButton *> pri_btn_;
     std::vector<Gtk::RadioButton *> sec_btn_;
     std::vector<Gtk::RadioButton *> snd_btn_;
@@ -48,6 +48,10 @@ static void handle_config(const char * name, const char * value)
 	free(mixer_port);
 	mixer_port = strdup(value);
     }
+    else
+    {
+	frame_timer_handle_config(name, value);
+    }
 }
 
 static unsigned int get_file_size_bytes(int fd) 
@@ -126,6 +130,7 @@ static void transfer_frames(struct transfer_params * params)
                 {
                     printf ("\n");
                     fflush(stdout);
+                    frame_timer_print_stats(stdout);
                 }
                 return;
             }
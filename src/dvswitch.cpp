@@ -22,6 +22,8 @@
 
 #include "config.h"
 //#include "connector.hpp"
+#include "frame_pool.hpp"
+#include "frame_timer.h"
 #include "mixer.hpp"
 #include "mixer_window.hpp"
 #include "server.hpp"
@@ -39,6 +41,13 @@ namespace
 
     std::string mixer_host;
     std::string mixer_port;
+    frame_pool_settings pool_settings[frame_pool_count];
+    mixer::source_settings source_settings;
+
+    bool parse_bool(const char * value)
+    {
+	return std::strcmp(value, "yes") == 0 || std::strcmp(value, "1") == 0;
+    }
 
     extern "C"
     {
@@ -48,6 +57,27 @@ namespace
 		mixer_host = value;
 	    else if (strcmp(name, "MIXER_PORT") == 0)
 		mixer_port = value;
+	    else if (strcmp(name, "SOURCE_MIN_BUFFER") == 0)
+		source_settings.min_queue_len = atoi(value);
+	    else if (strcmp(name, "SOURCE_MAX_BUFFER") == 0)
+		source_settings.max_queue_len = atoi(value);
+	    else if (strcmp(name, "DV_FRAME_POOL_SIZE") == 0)
+		pool_settings[frame_pool_dv_frame].capacity = atoi(value);
+	    else if (strcmp(name, "RAW_FRAME_POOL_SIZE") == 0)
+		pool_settings[frame_pool_raw_frame].capacity = atoi(value);
+	    else if (strcmp(name, "PCM_PACKET_POOL_SIZE") == 0)
+		pool_settings[frame_pool_pcm_packet].capacity = atoi(value);
+	    else if (strcmp(name, "FRAME_POOL_WAIT") == 0)
+		for (int i = 0; i != frame_pool_count; ++i)
+		    pool_settings[i].max_wait_ms = atoi(value);
+	    else if (strcmp(name, "FRAME_POOL_LOCK") == 0)
+		for (int i = 0; i != frame_pool_count; ++i)
+		    pool_settings[i].lock = parse_bool(value);
+	    else if (strcmp(name, "FRAME_POOL_HUGE_PAGES") == 0)
+		for (int i = 0; i != frame_pool_count; ++i)
+		    pool_settings[i].huge_pages = parse_bool(value);
+	    else
+		frame_timer_handle_config(name, value);
 	}
     }
 
@@ -103,6 +133,18 @@ int main(int argc, char **argv)
 	    return 2;
 	}
 
+	if (source_settings.min_queue_len < 1
+	    || source_settings.max_queue_len < source_settings.min_queue_len)
+	{
+	    std::cerr << argv[0] << ": invalid source buffer limits "
+		      << source_settings.min_queue_len << " to "
+		      << source_settings.max_queue_len << "\n";
+	    return 2;
+	}
+
+	for (int i = 0; i != frame_pool_count; ++i)
+	    configure_frame_pool(frame_pool_id(i), pool_settings[i]);
+
 	// The mixer must be created before the window, since we pass
 	// a reference to the mixer into the window's constructor to
 	// allow it to adjust the mixer's controls.
@@ -113,7 +155,8 @@ int main(int argc, char **argv)
 	// now we arrange this by attaching the window to an auto_ptr.
 	std::auto_ptr<mixer_window> the_window;
 	mixer the_mixer;
-	server the_server(mixer_host, mixer_port, the_mixer);
+	server the_server(mixer_host, mixer_port, the_mixer,
+			  source_settings);
 	/*connector the_connector(the_mixer);
 	the_window.reset(new mixer_window(the_mixer, the_connector));*/
 	the_window.reset(new mixer_window(the_mixer));
@@ -130,6 +173,23 @@ int main(int argc, char **argv)
 	    }
 	}
 	Gtk::Main::run();
+
+	for (int i = 0; i != frame_pool_count; ++i)
+	{
+	    frame_pool_stats stats = get_frame_pool_stats(frame_pool_id(i));
+	    std::cerr << "INFO: " << stats.name << " pool: "
+		      << stats.high_water << " buffers used at peak";
+	    if (stats.capacity)
+		std::cerr << " of " << stats.capacity;
+	    std::cerr << ", " << stats.failures << " allocation failures";
+	    if (stats.allocations)
+		std::cerr << ", mean/max allocation time "
+			  << stats.total_latency_ns / stats.allocations
+			  << "/" << stats.max_latency_ns << " ns";
+	    std::cerr << "\n";
+	}
+	frame_timer_print_stats(stderr);
+
 	return EXIT_SUCCESS;
     }
     catch (std::exception & e)
@@ -0,0 +1,34 @@
+// See the file "COPYING" for licence details.
+
+// Wakeup events using eventfd
+
+#include <cerrno>
+
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "event_fd.hpp"
+#include "os_error.hpp"
+
+event_fd::event_fd()
+    : fd_(eventfd(0, 0))
+{
+    os_check_nonneg("eventfd", fd_.get());
+}
+
+void event_fd::signal()
+{
+    uint64_t count = 1;
+    os_check_nonneg("write", write(fd_.get(), &count, sizeof(count)));
+}
+
+void event_fd::wait()
+{
+    uint64_t count;
+    ssize_t result;
+    do
+	result = read(fd_.get(), &count, sizeof(count));
+    while (result < 0 && errno == EINTR);
+    os_check_nonneg("read", result);
+}
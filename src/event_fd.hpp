@@ -0,0 +1,32 @@
+// See the file "COPYING" for licence details.
+
+// Wakeup events using eventfd
+
+#ifndef DVSWITCH_EVENT_FD_HPP
+#define DVSWITCH_EVENT_FD_HPP
+
+#include "auto_fd.hpp"
+
+// An event that one thread can wait for and other threads can
+// signal.  Signals are counted, so a signal that arrives before the
+// waiter starts waiting is not lost.
+
+class event_fd
+{
+public:
+    event_fd();
+
+    // Signal the event
+    void signal();
+    // Wait until the event has been signalled at least once since
+    // the last wait, and reset it
+    void wait();
+
+    // Get the file descriptor, e.g. for use with poll()
+    int get() const { return fd_.get(); }
+
+private:
+    auto_fd fd_;
+};
+
+#endif // !defined(DVSWITCH_EVENT_FD_HPP)
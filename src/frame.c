@@ -8,17 +8,18 @@
 #include <stddef.h>
 #include <string.h>
 
+#include <sys/uio.h>
+
 #include <libavutil/pixdesc.h>
 
 #include "avcodec_wrap.h"
 
 #include "frame.h"
 
-int raw_frame_get_buffer(AVCodecContext * context, AVFrame * header)
+static void set_planes(AVFrame * header, struct raw_frame * frame,
+		       enum PixelFormat pix_fmt)
 {
-    struct raw_frame * frame = context->opaque;
-
-    if (context->pix_fmt == PIX_FMT_YUV420P)
+    if (pix_fmt == PIX_FMT_YUV420P)
     {
 	header->data[0] = frame->buffer._420.y;
 	header->linesize[0] = FRAME_LINESIZE_4;
@@ -27,7 +28,7 @@ int raw_frame_get_buffer(AVCodecContext * context, AVFrame * header)
 	header->data[2] = frame->buffer._420.cr;
 	header->linesize[2] = FRAME_LINESIZE_2;
     }
-    else if (context->pix_fmt == PIX_FMT_YUV411P)
+    else if (pix_fmt == PIX_FMT_YUV411P)
     {
 	header->data[0] = frame->buffer._411.y;
 	header->linesize[0] = FRAME_LINESIZE_4;
@@ -41,7 +42,21 @@ int raw_frame_get_buffer(AVCodecContext * context, AVFrame * header)
 	assert(!"unexpected pixel format");
     }
 
-    frame->pix_fmt = context->pix_fmt;
+    frame->pix_fmt = pix_fmt;
+}
+
+void raw_frame_init_planes(struct raw_frame * frame, enum PixelFormat pix_fmt)
+{
+    set_planes(&frame->header, frame, pix_fmt);
+    frame->header.data[3] = 0;
+    frame->header.linesize[3] = 0;
+}
+
+int raw_frame_get_buffer(AVCodecContext * context, AVFrame * header)
+{
+    struct raw_frame * frame = context->opaque;
+
+    set_planes(header, frame, context->pix_fmt);
     header->type = FF_BUFFER_TYPE_USER;
 
     return 0;
@@ -97,3 +112,60 @@ void copy_raw_frame(struct raw_frame_ref dest,
     }
 }
 
+
+struct raw_frame_ref raw_frame_ref_band(struct raw_frame_ref frame,
+					unsigned top, unsigned bottom)
+{
+    int chroma_shift_horiz, chroma_shift_vert;
+    av_pix_fmt_get_chroma_sub_sample(frame.pix_fmt,
+                                     &chroma_shift_horiz, &chroma_shift_vert);
+
+    assert(top <= bottom && bottom <= frame.height);
+    assert(!(top & ((1U << chroma_shift_vert) - 1)));
+
+    for (int plane = 0; plane != 4; ++plane)
+    {
+	if (frame.planes.data[plane])
+	    frame.planes.data[plane] +=
+		frame.planes.linesize[plane]
+		* (plane == 0 ? top : top >> chroma_shift_vert);
+    }
+    frame.height = bottom - top;
+    return frame;
+}
+
+unsigned dv_frame_get_iovec(const struct dv_frame * frame,
+			    struct iovec * vector)
+{
+    const struct dv_system * system = dv_frame_system(frame);
+
+    if (!frame->video_frame)
+    {
+	vector[0].iov_base = (void *)frame->buffer;
+	vector[0].iov_len = system->size;
+	return 1;
+    }
+
+    // Each sequence starts with the header, subcode and VAUX blocks
+    // (6 in all), followed by 9 groups of an audio block and 15
+    // video blocks.  Take everything but video from this frame.
+    unsigned count = 0;
+    for (unsigned seq = 0; seq != system->seq_count; ++seq)
+    {
+	size_t offset = seq * DIF_SEQUENCE_SIZE;
+	for (unsigned group = 0; group != 9; ++group)
+	{
+	    size_t size = (group == 0 ? 7 : 1) * DIF_BLOCK_SIZE;
+	    vector[count].iov_base = (void *)(frame->buffer + offset);
+	    vector[count].iov_len = size;
+	    ++count;
+	    offset += size;
+	    vector[count].iov_base =
+		(void *)(frame->video_frame->buffer + offset);
+	    vector[count].iov_len = 15 * DIF_BLOCK_SIZE;
+	    ++count;
+	    offset += 15 * DIF_BLOCK_SIZE;
+	}
+    }
+    return count;
+}
@@ -13,6 +13,8 @@
 
 #include <sys/types.h>
 
+struct iovec;
+
 #include "avcodec_wrap.h"
 
 #include "dif.h"
@@ -28,9 +30,32 @@ struct dv_frame
     bool do_record;               // set by mixer
     bool cut_before;              // set by mixer
     bool format_error;            // set by mixer
+    bool have_audio_levels;       // set by server and mixer
+    struct dv_audio_levels audio_levels;
+    // If set, the video blocks in buffer are not valid and those of
+    // video_frame are used instead.  This lets the mixer repeat or
+    // pass through a frame with new audio and subcode without
+    // copying its video.
+    // video_frame is shared and must not be modified.  The frame
+    // holds a reference to it, which the frame pool releases.
+    struct dv_frame * video_frame; // set by mixer
     uint8_t buffer[DIF_MAX_FRAME_SIZE];
 };
 
+// Return the frame whose buffer holds the video blocks of frame
+static inline struct dv_frame * dv_frame_video(struct dv_frame * frame)
+{
+    return frame->video_frame ? frame->video_frame : frame;
+}
+
+// Maximum number of entries dv_frame_get_iovec() may use
+#define DV_FRAME_IOVEC_MAX (12 * 9 * 2)
+
+// Fill in vector with the locations of the frame's DIF blocks in
+// order, for use with writev().  Return the number of entries used.
+unsigned dv_frame_get_iovec(const struct dv_frame * frame,
+			    struct iovec * vector);
+
 static inline
 const struct dv_system * dv_frame_system(const struct dv_frame * frame)
 {
@@ -91,6 +116,11 @@ extern int raw_frame_get_buffer(AVCodecContext * context, AVFrame * av_frame);
 extern void raw_frame_release_buffer(AVCodecContext * context, AVFrame * frame);
 extern int raw_frame_reget_buffer(AVCodecContext * context, AVFrame * av_frame);
 
+// Point the plane pointers in frame->header at the frame's own buffer,
+// laid out for the given pixel format.
+extern void raw_frame_init_planes(struct raw_frame * frame,
+				  enum PixelFormat pix_fmt);
+
 static inline
 const struct dv_system * raw_frame_system(const struct raw_frame * frame)
 {
@@ -106,6 +136,12 @@ struct raw_frame_ref
 
 void copy_raw_frame(struct raw_frame_ref dest, struct raw_frame_ref source);
 
+// Return a reference to the horizontal band of frame from row top
+// (inclusive) to row bottom (exclusive).  top must be a multiple of
+// the vertical chroma subsampling factor.
+struct raw_frame_ref raw_frame_ref_band(struct raw_frame_ref frame,
+					unsigned top, unsigned bottom);
+
 #ifdef __cplusplus
 }
 #endif
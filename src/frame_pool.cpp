@@ -3,61 +3,551 @@
 
 // DIF and raw video frame buffer pools
 
-#include <boost/pool/object_pool.hpp>
-#include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <ostream>
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "avcodec_wrap.h"
 
 #include "frame.h"
 #include "frame_pool.hpp"
+#include "os_error.hpp"
 
 namespace
 {
-    boost::mutex dv_frame_pool_mutex; // controls access to the following
-    boost::object_pool<dv_frame> dv_frame_pool(100);
-
-    void free_dv_frame(dv_frame * frame)
+    // Bounded lock-free multi-producer multi-consumer queue of free
+    // buffers, shared by all threads.  This is Dmitry Vyukov's
+    // algorithm, where each cell has a sequence number which tells
+    // producers and consumers whether it is ready for them.
+    class buffer_depot
     {
-	boost::mutex::scoped_lock lock(dv_frame_pool_mutex);
-	if (frame)
-	    dv_frame_pool.free(frame);
-    }
+    public:
+	static const std::size_t capacity = 1024;
 
-    boost::mutex raw_frame_pool_mutex; // controls access to the following
-    boost::object_pool<raw_frame> raw_frame_pool(10);
+	buffer_depot()
+	    : enqueue_pos_(0), dequeue_pos_(0)
+	{
+	    for (std::size_t i = 0; i != capacity; ++i)
+		cells_[i].sequence = i;
+	}
 
-    void free_raw_frame(raw_frame * frame)
-    {
-	boost::mutex::scoped_lock lock(raw_frame_pool_mutex);
-	if (frame)
-	    raw_frame_pool.free(frame);
-    }
+	// Return false if the depot is full
+	bool push(void * buffer)
+	{
+	    cell * cell;
+	    std::size_t pos = __atomic_load_n(&enqueue_pos_, __ATOMIC_RELAXED);
+	    for (;;)
+	    {
+		cell = &cells_[pos & (capacity - 1)];
+		std::size_t seq =
+		    __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+		std::ptrdiff_t dif = std::ptrdiff_t(seq) - std::ptrdiff_t(pos);
+		if (dif == 0)
+		{
+		    if (__atomic_compare_exchange_n(&enqueue_pos_, &pos, pos + 1,
+						    true, __ATOMIC_RELAXED,
+						    __ATOMIC_RELAXED))
+			break;
+		}
+		else if (dif < 0)
+		{
+		    return false;
+		}
+		else
+		{
+		    pos = __atomic_load_n(&enqueue_pos_, __ATOMIC_RELAXED);
+		}
+	    }
+	    cell->buffer = buffer;
+	    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+	    return true;
+	}
+
+	// Return null if the depot is empty
+	void * pop()
+	{
+	    cell * cell;
+	    std::size_t pos = __atomic_load_n(&dequeue_pos_, __ATOMIC_RELAXED);
+	    for (;;)
+	    {
+		cell = &cells_[pos & (capacity - 1)];
+		std::size_t seq =
+		    __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+		std::ptrdiff_t dif =
+		    std::ptrdiff_t(seq) - std::ptrdiff_t(pos + 1);
+		if (dif == 0)
+		{
+		    if (__atomic_compare_exchange_n(&dequeue_pos_, &pos, pos + 1,
+						    true, __ATOMIC_RELAXED,
+						    __ATOMIC_RELAXED))
+			break;
+		}
+		else if (dif < 0)
+		{
+		    return 0;
+		}
+		else
+		{
+		    pos = __atomic_load_n(&dequeue_pos_, __ATOMIC_RELAXED);
+		}
+	    }
+	    void * buffer = cell->buffer;
+	    __atomic_store_n(&cell->sequence, pos + capacity, __ATOMIC_RELEASE);
+	    return buffer;
+	}
 
-    boost::mutex pcm_packet_pool_mutex; // controls access to the following
-    boost::object_pool<pcm_packet> pcm_packet_pool(100);
+    private:
+	struct cell
+	{
+	    std::size_t sequence;
+	    void * buffer;
+	};
 
-    void free_pcm_packet(pcm_packet * frame)
+	cell cells_[capacity];
+	std::size_t enqueue_pos_ __attribute__((aligned(64)));
+	std::size_t dequeue_pos_ __attribute__((aligned(64)));
+    };
+
+    unsigned long long get_time_ns()
     {
-	boost::mutex::scoped_lock lock(pcm_packet_pool_mutex);
-	if (frame)
-	    pcm_packet_pool.free(frame);
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
     }
+
+    // Pool of buffers of a single type.  Buffers are moved between
+    // thread caches and the depot in batches, so that most
+    // allocations and releases only touch the thread's own cache.
+    // Buffers are never returned to the heap, except for those
+    // allocated beyond the capacity of a bounded pool.
+    //
+    // A bounded pool must not let too many buffers sit in thread
+    // caches.  The caches are kept small relative to its capacity,
+    // and when it is exhausted every thread is asked to flush its
+    // cache back to the depot on its next allocation or release.
+    template<typename T>
+    class buffer_pool
+    {
+    public:
+	explicit buffer_pool(const char * name)
+	    : name_(name),
+	      region_(0),
+	      region_size_(0),
+	      max_wait_ms_(0),
+	      warned_(false),
+	      cache_limit_(2 * max_batch_size),
+	      flush_generation_(0)
+	{
+	    assert(offsetof(node, object) == sizeof(frame_pool_header));
+	    std::memset(&stats_, 0, sizeof(stats_));
+	    stats_.name = name;
+	    os_check_error("pthread_key_create",
+			   pthread_key_create(&cache_key_, destroy_cache));
+	}
+
+	void configure(const frame_pool_settings & settings)
+	{
+	    assert(!region_ && stats_.allocations == 0);
+
+	    std::size_t capacity = settings.capacity;
+	    if (capacity == 0)
+		return;
+	    if (capacity > buffer_depot::capacity)
+	    {
+		std::cerr << "WARN: Limiting " << name_ << " pool to "
+			  << buffer_depot::capacity << " buffers\n";
+		capacity = buffer_depot::capacity;
+	    }
+
+	    std::size_t size = capacity * sizeof(node);
+	    void * region = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	    if (settings.huge_pages)
+	    {
+		const std::size_t huge_page_size = 2 << 20;
+		std::size_t huge_size =
+		    (size + huge_page_size - 1) & ~(huge_page_size - 1);
+		region = mmap(0, huge_size, PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB
+			      | MAP_POPULATE,
+			      -1, 0);
+		if (region == MAP_FAILED)
+		    std::cerr << "WARN: Could not allocate huge pages for "
+			      << name_ << " pool: " << std::strerror(errno)
+			      << "\n";
+		else
+		    size = huge_size;
+	    }
+#else
+	    if (settings.huge_pages)
+		std::cerr << "WARN: Huge pages are not supported\n";
+#endif
+	    if (region == MAP_FAILED)
+	    {
+		region = mmap(0, size, PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+			      -1, 0);
+		if (region == MAP_FAILED)
+		    throw os_error("mmap");
+	    }
+	    if (settings.lock && mlock(region, size) != 0)
+		std::cerr << "WARN: Could not lock " << name_ << " pool: "
+			  << std::strerror(errno) << "\n";
+
+	    // Write to every page so that none are left to be faulted
+	    // in (or copied-on-write) during allocation
+	    const std::size_t page_size = sysconf(_SC_PAGESIZE);
+	    for (std::size_t offset = 0; offset < size; offset += page_size)
+		static_cast<volatile char *>(region)[offset] = 0;
+
+	    node * nodes = static_cast<node *>(region);
+	    for (std::size_t i = 0; i != capacity; ++i)
+	    {
+		bool pushed = depot_.push(&nodes[i].object);
+		assert(pushed);
+		(void)pushed;
+	    }
+
+	    region_ = region;
+	    region_size_ = size;
+	    max_wait_ms_ = settings.max_wait_ms;
+	    cache_limit_ = std::max<std::size_t>(
+		2, std::min(2 * max_batch_size, capacity / 8));
+	    stats_.capacity = capacity;
+	}
+
+	// Allocate a buffer.  If the pool is bounded and exhausted,
+	// either return null (if wait is false) or wait for a buffer to
+	// be freed and then fall back to the heap.
+	T * allocate(bool wait)
+	{
+	    unsigned long long start_time = get_time_ns();
+	    thread_cache & cache = get_cache();
+	    void * buffer;
+
+	    check_flush_request(cache);
+
+	    if (cache.head || refill_cache(cache)
+		|| (wait && wait_for_buffer(cache, start_time)))
+	    {
+		buffer = cache.head;
+		cache.head = *static_cast<void **>(buffer);
+		--cache.count;
+	    }
+	    else
+	    {
+		__atomic_add_fetch(&stats_.failures, 1, __ATOMIC_RELAXED);
+		if (!__atomic_exchange_n(&warned_, true, __ATOMIC_RELAXED))
+		    std::cerr << "WARN: " << name_ << " pool exhausted\n";
+		if (!wait)
+		    return 0;
+		buffer = allocate_node();
+	    }
+
+	    get_frame_pool_header(buffer)->ref_count = 0;
+	    update_stats(start_time);
+	    return static_cast<T *>(buffer);
+	}
+
+	void free(T * frame)
+	{
+	    __atomic_sub_fetch(&stats_.in_use, 1, __ATOMIC_RELAXED);
+
+	    // Overflow buffers go straight back to the heap
+	    if (region_ && !is_in_region(frame))
+	    {
+		free_node(frame);
+		return;
+	    }
+
+	    thread_cache & cache = get_cache();
+	    *reinterpret_cast<void **>(frame) = cache.head;
+	    cache.head = frame;
+	    if (++cache.count >= cache_limit_)
+		flush_cache(cache, cache_limit_ / 2);
+	    else
+		check_flush_request(cache);
+	}
+
+	frame_pool_stats get_stats() const
+	{
+	    frame_pool_stats stats;
+	    stats.name = stats_.name;
+	    stats.capacity = stats_.capacity;
+	    stats.in_use = __atomic_load_n(&stats_.in_use, __ATOMIC_RELAXED);
+	    stats.high_water =
+		__atomic_load_n(&stats_.high_water, __ATOMIC_RELAXED);
+	    stats.allocations =
+		__atomic_load_n(&stats_.allocations, __ATOMIC_RELAXED);
+	    stats.failures =
+		__atomic_load_n(&stats_.failures, __ATOMIC_RELAXED);
+	    stats.total_latency_ns =
+		__atomic_load_n(&stats_.total_latency_ns, __ATOMIC_RELAXED);
+	    stats.max_latency_ns =
+		__atomic_load_n(&stats_.max_latency_ns, __ATOMIC_RELAXED);
+	    return stats;
+	}
+
+    private:
+	static const std::size_t max_batch_size = 8;
+
+	// Each buffer has its header followed by the object
+	struct node
+	{
+	    frame_pool_header header;
+	    T object;
+	};
+
+	// Per-thread list of free buffers.  The link to the next free
+	// buffer is stored in the buffer itself.
+	struct thread_cache
+	{
+	    void * head;
+	    std::size_t count;
+	    buffer_pool * pool;
+	    unsigned flush_generation;
+	};
+
+	thread_cache & get_cache()
+	{
+	    // One cache per thread for each pool type
+	    static __thread thread_cache * cache;
+	    if (!cache)
+	    {
+		std::auto_ptr<thread_cache> new_cache(new thread_cache());
+		new_cache->pool = this;
+		new_cache->flush_generation =
+		    __atomic_load_n(&flush_generation_, __ATOMIC_RELAXED);
+		os_check_error("pthread_setspecific",
+			       pthread_setspecific(cache_key_, new_cache.get()));
+		cache = new_cache.release();
+	    }
+	    return *cache;
+	}
+
+	bool is_in_region(void * buffer) const
+	{
+	    char * p = static_cast<char *>(buffer);
+	    char * begin = static_cast<char *>(region_);
+	    return p >= begin && p < begin + region_size_;
+	}
+
+	void * allocate_node()
+	{
+	    node * new_node = static_cast<node *>(std::malloc(sizeof(node)));
+	    if (!new_node)
+		throw std::bad_alloc();
+	    return &new_node->object;
+	}
+
+	static void free_node(void * buffer)
+	{
+	    std::free(static_cast<char *>(buffer) - offsetof(node, object));
+	}
+
+	// Move a batch of buffers from the depot to the cache.  A
+	// bounded pool may come up short.  Return true if the cache is
+	// no longer empty.
+	bool refill_cache(thread_cache & cache)
+	{
+	    for (std::size_t i = 0; i != cache_limit_ / 2; ++i)
+	    {
+		void * buffer = depot_.pop();
+		if (!buffer)
+		{
+		    if (region_)
+			break;
+		    buffer = allocate_node();
+		}
+		*static_cast<void **>(buffer) = cache.head;
+		cache.head = buffer;
+		++cache.count;
+	    }
+	    return cache.head != 0;
+	}
+
+	// Poll the depot until a buffer is freed or the wait limit
+	// is reached
+	bool wait_for_buffer(thread_cache & cache,
+			     unsigned long long start_time)
+	{
+	    const timespec poll_interval = { 0, 1000000 };
+	    __atomic_add_fetch(&flush_generation_, 1, __ATOMIC_RELAXED);
+	    while (get_time_ns() - start_time < max_wait_ms_ * 1000000ULL)
+	    {
+		nanosleep(&poll_interval, 0);
+		if (refill_cache(cache))
+		    return true;
+	    }
+	    return false;
+	}
+
+	// Flush the whole cache if another thread has found the pool
+	// exhausted since the last check
+	void check_flush_request(thread_cache & cache)
+	{
+	    unsigned generation =
+		__atomic_load_n(&flush_generation_, __ATOMIC_RELAXED);
+	    if (cache.flush_generation != generation)
+	    {
+		cache.flush_generation = generation;
+		flush_cache(cache, cache.count);
+	    }
+	}
+
+	void flush_cache(thread_cache & cache, std::size_t count)
+	{
+	    while (count-- && cache.head)
+	    {
+		void * buffer = cache.head;
+		cache.head = *static_cast<void **>(buffer);
+		--cache.count;
+		if (!depot_.push(buffer))
+		{
+		    assert(!region_);
+		    free_node(buffer);
+		}
+	    }
+	}
+
+	void update_stats(unsigned long long start_time)
+	{
+	    std::size_t in_use =
+		__atomic_add_fetch(&stats_.in_use, 1, __ATOMIC_RELAXED);
+	    std::size_t high_water =
+		__atomic_load_n(&stats_.high_water, __ATOMIC_RELAXED);
+	    while (in_use > high_water
+		   && !__atomic_compare_exchange_n(&stats_.high_water,
+						   &high_water, in_use, true,
+						   __ATOMIC_RELAXED,
+						   __ATOMIC_RELAXED))
+		;
+
+	    unsigned long long latency = get_time_ns() - start_time;
+	    __atomic_add_fetch(&stats_.allocations, 1, __ATOMIC_RELAXED);
+	    __atomic_add_fetch(&stats_.total_latency_ns, latency,
+			       __ATOMIC_RELAXED);
+	    unsigned long long max_latency =
+		__atomic_load_n(&stats_.max_latency_ns, __ATOMIC_RELAXED);
+	    while (latency > max_latency
+		   && !__atomic_compare_exchange_n(&stats_.max_latency_ns,
+						   &max_latency, latency, true,
+						   __ATOMIC_RELAXED,
+						   __ATOMIC_RELAXED))
+		;
+	}
+
+	// Return a thread's cached buffers when it exits
+	static void destroy_cache(void * p)
+	{
+	    thread_cache * cache = static_cast<thread_cache *>(p);
+	    cache->pool->flush_cache(*cache, cache->count);
+	    delete cache;
+	}
+
+	const char * name_;
+	buffer_depot depot_;
+	pthread_key_t cache_key_;
+	void * region_;
+	std::size_t region_size_;
+	unsigned max_wait_ms_;
+	bool warned_;
+	// Maximum number of buffers in each thread's cache; half of
+	// them are moved to or from the depot at a time
+	std::size_t cache_limit_;
+	unsigned flush_generation_; // updated atomically
+	frame_pool_stats stats_;
+    };
+
+    buffer_pool<dv_frame> dv_frame_pool("DV frame");
+    buffer_pool<raw_frame> raw_frame_pool("raw frame");
+    buffer_pool<pcm_packet> pcm_packet_pool("PCM packet");
+}
+
+void free_dv_frame(dv_frame * frame)
+{
+    dv_frame * video_frame = frame->video_frame;
+    dv_frame_pool.free(frame);
+    if (video_frame)
+	intrusive_ptr_release(video_frame);
+}
+
+void free_raw_frame(raw_frame * frame)
+{
+    raw_frame_pool.free(frame);
+}
+
+void free_pcm_packet(pcm_packet * packet)
+{
+    pcm_packet_pool.free(packet);
 }
 
 dv_frame_ptr allocate_dv_frame()
 {
-    boost::mutex::scoped_lock lock(dv_frame_pool_mutex);
-    return dv_frame_ptr(dv_frame_pool.malloc(), free_dv_frame);
+    dv_frame * frame = dv_frame_pool.allocate(true);
+    frame->video_frame = 0;
+    return dv_frame_ptr(frame);
 }
 
 raw_frame_ptr allocate_raw_frame()
 {
-    boost::mutex::scoped_lock lock(raw_frame_pool_mutex);
-    return raw_frame_ptr(raw_frame_pool.malloc(), free_raw_frame);
+    return raw_frame_ptr(raw_frame_pool.allocate(true));
 }
 
 pcm_packet_ptr allocate_pcm_packet()
 {
-    boost::mutex::scoped_lock lock(pcm_packet_pool_mutex);
-    return pcm_packet_ptr(pcm_packet_pool.malloc(), free_pcm_packet);
+    return pcm_packet_ptr(pcm_packet_pool.allocate(true));
+}
+
+dv_frame_ptr try_allocate_dv_frame()
+{
+    dv_frame * frame = dv_frame_pool.allocate(false);
+    if (frame)
+	frame->video_frame = 0;
+    return dv_frame_ptr(frame);
+}
+
+void configure_frame_pool(frame_pool_id id,
+			  const frame_pool_settings & settings)
+{
+    switch (id)
+    {
+    case frame_pool_dv_frame:
+	dv_frame_pool.configure(settings);
+	break;
+    case frame_pool_raw_frame:
+	raw_frame_pool.configure(settings);
+	break;
+    case frame_pool_pcm_packet:
+	pcm_packet_pool.configure(settings);
+	break;
+    default:
+	assert(!"invalid frame pool id");
+    }
+}
+
+frame_pool_stats get_frame_pool_stats(frame_pool_id id)
+{
+    switch (id)
+    {
+    case frame_pool_dv_frame:
+	return dv_frame_pool.get_stats();
+    case frame_pool_raw_frame:
+	return raw_frame_pool.get_stats();
+    default:
+	assert(id == frame_pool_pcm_packet);
+	return pcm_packet_pool.get_stats();
+    }
 }
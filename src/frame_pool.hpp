@@ -6,19 +6,84 @@
 #ifndef DVSWITCH_FRAME_POOL_HPP
 #define DVSWITCH_FRAME_POOL_HPP
 
-#include <tr1/memory>
+#include <cstddef>
+
+#include <boost/intrusive_ptr.hpp>
 
 // Memory pool for frame buffers.  This should make frame
-// (de)allocation relatively cheap.
+// (de)allocation relatively cheap.  Each thread keeps a cache of
+// free buffers, and only goes to a shared (lock-free) depot when its
+// cache is empty or overfull.
+//
+// By default a pool grows on demand and never gives memory back.
+// A pool can instead be given a fixed capacity, in which case all its
+// buffers are allocated and pre-faulted up front.
 
 struct dv_frame;
 struct raw_frame;
 struct pcm_packet;
 
+// Each pooled buffer is preceded by this header, so that the
+// reference count needs no separate allocation
+struct frame_pool_header
+{
+    unsigned ref_count;
+} __attribute__((aligned(16)));
+
+inline frame_pool_header * get_frame_pool_header(void * buffer)
+{
+    return static_cast<frame_pool_header *>(buffer) - 1;
+}
+
+inline void frame_pool_add_ref(void * buffer)
+{
+    __atomic_add_fetch(&get_frame_pool_header(buffer)->ref_count, 1,
+		       __ATOMIC_RELAXED);
+}
+
+// Decrement the reference count and return true if it reached 0
+inline bool frame_pool_release_ref(void * buffer)
+{
+    return __atomic_sub_fetch(&get_frame_pool_header(buffer)->ref_count, 1,
+			      __ATOMIC_ACQ_REL) == 0;
+}
+
+void free_dv_frame(dv_frame *);
+void free_raw_frame(raw_frame *);
+void free_pcm_packet(pcm_packet *);
+
+inline void intrusive_ptr_add_ref(dv_frame * frame)
+{
+    frame_pool_add_ref(frame);
+}
+inline void intrusive_ptr_release(dv_frame * frame)
+{
+    if (frame_pool_release_ref(frame))
+	free_dv_frame(frame);
+}
+inline void intrusive_ptr_add_ref(raw_frame * frame)
+{
+    frame_pool_add_ref(frame);
+}
+inline void intrusive_ptr_release(raw_frame * frame)
+{
+    if (frame_pool_release_ref(frame))
+	free_raw_frame(frame);
+}
+inline void intrusive_ptr_add_ref(pcm_packet * packet)
+{
+    frame_pool_add_ref(packet);
+}
+inline void intrusive_ptr_release(pcm_packet * packet)
+{
+    if (frame_pool_release_ref(packet))
+	free_pcm_packet(packet);
+}
+
 // Reference-counting pointers to frames
-typedef std::tr1::shared_ptr<dv_frame> dv_frame_ptr;
-typedef std::tr1::shared_ptr<raw_frame> raw_frame_ptr;
-typedef std::tr1::shared_ptr<pcm_packet> pcm_packet_ptr;
+typedef boost::intrusive_ptr<dv_frame> dv_frame_ptr;
+typedef boost::intrusive_ptr<raw_frame> raw_frame_ptr;
+typedef boost::intrusive_ptr<pcm_packet> pcm_packet_ptr;
 
 // Allocate a DV frame buffer
 dv_frame_ptr allocate_dv_frame();
@@ -29,4 +94,52 @@ raw_frame_ptr allocate_raw_frame();
 // Allocate a PCM pcket buffer
 pcm_packet_ptr allocate_pcm_packet();
 
+// Allocate a DV frame buffer, or return a null pointer if the pool
+// is bounded and exhausted
+dv_frame_ptr try_allocate_dv_frame();
+
+enum frame_pool_id
+{
+    frame_pool_dv_frame,
+    frame_pool_raw_frame,
+    frame_pool_pcm_packet,
+    frame_pool_count
+};
+
+struct frame_pool_settings
+{
+    frame_pool_settings()
+	: capacity(0), max_wait_ms(40), lock(false), huge_pages(false)
+    {}
+
+    // Number of buffers, or 0 for a pool that grows on demand
+    std::size_t capacity;
+    // How long allocate_*() waits for a buffer to be freed when a
+    // bounded pool is exhausted.  After this the allocation is
+    // counted as a failure and satisfied from the heap.
+    unsigned max_wait_ms;
+    // Lock the buffers into memory
+    bool lock;
+    // Try to put the buffers in huge pages
+    bool huge_pages;
+};
+
+// Set up a pool.  This must be called before any buffer is allocated
+// from the pool.
+void configure_frame_pool(frame_pool_id, const frame_pool_settings &);
+
+struct frame_pool_stats
+{
+    const char * name;
+    std::size_t capacity;
+    std::size_t in_use;
+    std::size_t high_water;
+    unsigned long long allocations;
+    unsigned long long failures;
+    unsigned long long total_latency_ns;
+    unsigned long long max_latency_ns;
+};
+
+frame_pool_stats get_frame_pool_stats(frame_pool_id);
+
 #endif // !DVSWITCH_FRAME_POOL_HPP
@@ -7,21 +7,43 @@
 #include <errno.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 
 #include "frame_timer.h"
 
+// Ways of waiting for a timestamp
+enum frame_timer_backend {
+    frame_timer_backend_nanosleep, // clock_nanosleep() (default)
+    frame_timer_backend_timerfd,   // timerfd
+    frame_timer_backend_signal     // POSIX timer delivering SIGALRM
+};
+
+static enum frame_timer_backend frame_timer_backend =
+    frame_timer_backend_nanosleep;
+static unsigned frame_timer_spin_ns;
+
+// These are created on first use by the respective backends
+static bool frame_timer_id_valid;
 static timer_t frame_timer_id;
+static int frame_timer_fd = -1;
+
+static struct frame_timer_stats frame_timer_stats;
+
 struct timespec frame_timer_res;
 
 void frame_timer_init(void)
 {
+    // SIGALRM must be blocked in all threads in case the signal
+    // backend is used.
     sigset_t sigset_alarm;
     sigemptyset(&sigset_alarm);
     sigaddset(&sigset_alarm, SIGALRM);
@@ -51,15 +73,24 @@ void frame_timer_init(void)
 	      stderr);
 	exit(1);
     }
+}
 
-    struct sigevent event = {
-	.sigev_notify = SIGEV_SIGNAL,
-	.sigev_signo =  SIGALRM
-    };
-    if (timer_create(CLOCK_MONOTONIC, &event, &frame_timer_id) != 0)
+void frame_timer_handle_config(const char * name, const char * value)
+{
+    if (strcmp(name, "FRAME_TIMER") == 0)
     {
-	perror("FATAL: timer_create");
-	exit(1);
+	if (strcmp(value, "nanosleep") == 0)
+	    frame_timer_backend = frame_timer_backend_nanosleep;
+	else if (strcmp(value, "timerfd") == 0)
+	    frame_timer_backend = frame_timer_backend_timerfd;
+	else if (strcmp(value, "signal") == 0)
+	    frame_timer_backend = frame_timer_backend_signal;
+	else
+	    fprintf(stderr, "WARN: Unknown FRAME_TIMER \"%s\"\n", value);
+    }
+    else if (strcmp(name, "FRAME_TIMER_SPIN") == 0)
+    {
+	frame_timer_spin_ns = 1000 * strtoul(value, NULL, 10);
     }
 }
 
@@ -74,11 +105,82 @@ uint64_t frame_timer_get(void)
     return (uint64_t)result.tv_sec * 1000000000 + result.tv_nsec;
 }
 
-void frame_timer_wait(uint64_t point)
+static struct timespec frame_timer_timespec(uint64_t point)
+{
+    struct timespec result = {
+	.tv_sec = point / 1000000000,
+	.tv_nsec = point % 1000000000
+    };
+    return result;
+}
+
+static void frame_timer_wait_nanosleep(uint64_t point)
+{
+    struct timespec value = frame_timer_timespec(point);
+    int rc;
+    while ((rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+				 &value, NULL)) == EINTR)
+	;
+    if (rc != 0)
+    {
+	errno = rc;
+	perror("FATAL: clock_nanosleep");
+	exit(1);
+    }
+}
+
+static void frame_timer_wait_timerfd(uint64_t point)
+{
+    if (frame_timer_fd < 0)
+    {
+	frame_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (frame_timer_fd < 0)
+	{
+	    perror("FATAL: timerfd_create");
+	    exit(1);
+	}
+    }
+
+    struct itimerspec interval = {
+	.it_value = frame_timer_timespec(point),
+	.it_interval = { .tv_sec = 0,
+			 .tv_nsec = 0 }
+    };
+    if (timerfd_settime(frame_timer_fd, TFD_TIMER_ABSTIME, &interval, 0)
+	!= 0)
+    {
+	perror("FATAL: timerfd_settime");
+	exit(1);
+    }
+    uint64_t expirations;
+    while (read(frame_timer_fd, &expirations, sizeof(expirations)) < 0)
+    {
+	if (errno != EINTR)
+	{
+	    perror("FATAL: read");
+	    exit(1);
+	}
+    }
+}
+
+static void frame_timer_wait_signal(uint64_t point)
 {
+    if (!frame_timer_id_valid)
+    {
+	struct sigevent event = {
+	    .sigev_notify = SIGEV_SIGNAL,
+	    .sigev_signo =  SIGALRM
+	};
+	if (timer_create(CLOCK_MONOTONIC, &event, &frame_timer_id) != 0)
+	{
+	    perror("FATAL: timer_create");
+	    exit(1);
+	}
+	frame_timer_id_valid = true;
+    }
+
     struct itimerspec interval = {
-	.it_value = { .tv_sec = point / 1000000000,
-		      .tv_nsec = point % 1000000000 },
+	.it_value = frame_timer_timespec(point),
 	.it_interval = { .tv_sec = 0,
 			 .tv_nsec = 0 }
     };
@@ -93,3 +195,80 @@ void frame_timer_wait(uint64_t point)
     int dummy;
     sigwait(&sigset_alarm, &dummy);
 }
+
+static void frame_timer_record(uint64_t overshoot)
+{
+    unsigned bucket = 0;
+    for (uint64_t us = overshoot / 1000;
+	 us != 0 && bucket != FRAME_TIMER_HISTOGRAM_SIZE - 1;
+	 us >>= 1)
+	++bucket;
+
+    ++frame_timer_stats.ticks;
+    frame_timer_stats.total_overshoot += overshoot;
+    if (overshoot > frame_timer_stats.max_overshoot)
+	frame_timer_stats.max_overshoot = overshoot;
+    ++frame_timer_stats.histogram[bucket];
+}
+
+void frame_timer_wait(uint64_t point)
+{
+    uint64_t now = frame_timer_get();
+
+    // Sleep until shortly before the given time, if spinning, and
+    // then spin
+    if (now + frame_timer_spin_ns < point)
+    {
+	uint64_t sleep_point = point - frame_timer_spin_ns;
+	switch (frame_timer_backend)
+	{
+	case frame_timer_backend_nanosleep:
+	    frame_timer_wait_nanosleep(sleep_point);
+	    break;
+	case frame_timer_backend_timerfd:
+	    frame_timer_wait_timerfd(sleep_point);
+	    break;
+	case frame_timer_backend_signal:
+	    frame_timer_wait_signal(sleep_point);
+	    break;
+	}
+	now = frame_timer_get();
+    }
+    while (now < point)
+	now = frame_timer_get();
+
+    frame_timer_record(now - point);
+}
+
+void frame_timer_get_stats(struct frame_timer_stats * stats)
+{
+    *stats = frame_timer_stats;
+}
+
+void frame_timer_print_stats(FILE * file)
+{
+    struct frame_timer_stats stats;
+    frame_timer_get_stats(&stats);
+    if (stats.ticks == 0)
+	return;
+
+    fprintf(file,
+	    "INFO: Frame timer overshoot over %llu ticks:"
+	    " mean %llu us, max %llu us\n",
+	    (unsigned long long)stats.ticks,
+	    (unsigned long long)(stats.total_overshoot / stats.ticks / 1000),
+	    (unsigned long long)(stats.max_overshoot / 1000));
+    for (unsigned bucket = 0; bucket != FRAME_TIMER_HISTOGRAM_SIZE; ++bucket)
+    {
+	if (stats.histogram[bucket] == 0)
+	    continue;
+	if (bucket == 0)
+	    fprintf(file, "INFO:   < 1 us: ");
+	else if (bucket == FRAME_TIMER_HISTOGRAM_SIZE - 1)
+	    fprintf(file, "INFO:   >= %u us: ", 1U << (bucket - 1));
+	else
+	    fprintf(file, "INFO:   %u-%u us: ",
+		    1U << (bucket - 1), (1U << bucket) - 1);
+	fprintf(file, "%llu\n", (unsigned long long)stats.histogram[bucket]);
+    }
+}
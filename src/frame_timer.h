@@ -7,6 +7,7 @@
 #define DVSWITCH_FRAME_TIMER_H
 
 #include <stdint.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -17,6 +18,13 @@ extern "C" {
 // following functions are used.
 void frame_timer_init(void);
 
+// Handle configuration items FRAME_TIMER (nanosleep, timerfd or
+// signal), which selects how to wait, and FRAME_TIMER_SPIN, the time
+// in us to busy-wait at the end of each wait.  Other items are
+// ignored.  This must not be called while another thread may be in
+// frame_timer_wait().
+void frame_timer_handle_config(const char * name, const char * value);
+
 // Get a timestamp.  This is the time since an unspecified point in
 // the past, in ns.
 uint64_t frame_timer_get(void);
@@ -25,6 +33,24 @@ uint64_t frame_timer_get(void);
 // timestamp.
 void frame_timer_wait(uint64_t timestamp);
 
+// Histogram of how late frame_timer_wait() returns.  Bucket 0 counts
+// overshoots below 1 us and bucket i counts those in [2^(i-1), 2^i) us,
+// except that the last bucket also counts all longer overshoots.
+#define FRAME_TIMER_HISTOGRAM_SIZE 16
+struct frame_timer_stats {
+    uint64_t ticks;
+    uint64_t total_overshoot;   // ns
+    uint64_t max_overshoot;     // ns
+    uint64_t histogram[FRAME_TIMER_HISTOGRAM_SIZE];
+};
+
+// Get the statistics so far.  If another thread is waiting, they
+// may be slightly inconsistent.
+void frame_timer_get_stats(struct frame_timer_stats * stats);
+
+// Print the statistics as INFO messages
+void frame_timer_print_stats(FILE * file);
+
 #ifdef __cplusplus
 }
 #endif
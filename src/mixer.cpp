@@ -8,6 +8,7 @@
 // mixes frames at each clock tick, and passes frames in the sinks and
 // monitor.
 
+#include <algorithm>
 #include <cstddef>
 #include <cstring>
 #include <iostream>
@@ -18,6 +19,7 @@
 #include <unistd.h>
 
 #include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread/thread.hpp>
 
 #include "auto_codec.hpp"
@@ -25,6 +27,7 @@
 #include "frame_timer.h"
 #include "mixer.hpp"
 #include "os_error.hpp"
+#include "pcm_mix.h"
 #include "ring_buffer.hpp"
 #include "video_effect.h"
 
@@ -33,17 +36,69 @@ struct mixer::video_mix
 {
     virtual void validate(const mixer &) = 0;
     virtual void set_active(const mixer &, bool active) = 0;
-    virtual bool apply(const mix_data &, const auto_codec &,
-		       raw_frame_ptr &, dv_frame_ptr &) = 0;
+    virtual bool apply(mixer &, const mix_data &, mix_result &) = 0;
     virtual void status(mixer::monitor * monitor) = 0;
+    // Return a simple mix to take over from a transition that has
+    // finished, or a null pointer.  This is called after apply().
+    virtual std::tr1::shared_ptr<video_mix> get_successor() const
+    {
+	return std::tr1::shared_ptr<video_mix>();
+    }
 };
 
+namespace
+{
+    // Limit on the number of threads used for each CPU-bound job,
+    // i.e. the video mixing workers and the DV encoders
+    const unsigned max_thread_count = 8;
+
+    // Maximum reduction in resolution (as a power of 2) that the DV
+    // decoder supports
+    const unsigned max_lowres = 3;
+
+    // Create decoders for each worker at each resolution, ordered
+    // by resolution
+    auto_codec * create_raw_decoders(unsigned worker_count)
+    {
+	const unsigned count = worker_count * (1 + max_lowres);
+	auto_codec * decoders = new auto_codec[count];
+	try
+	{
+	    for (unsigned i = 0; i != count; ++i)
+	    {
+		auto_codec decoder(avcodec_alloc_context3(NULL));
+		AVCodecContext * dec = decoder.get();
+		if (!dec)
+		    throw std::bad_alloc();
+		dec->lowres = i / worker_count;
+		auto_codec_open_decoder(decoder, AV_CODEC_ID_DVVIDEO);
+		dec->get_buffer = raw_frame_get_buffer;
+		dec->release_buffer = raw_frame_release_buffer;
+		dec->reget_buffer = raw_frame_reget_buffer;
+		decoders[i] = decoder;
+	    }
+	}
+	catch (...)
+	{
+	    delete[] decoders;
+	    throw;
+	}
+	return decoders;
+    }
+}
+
 mixer::mixer()
     : clock_state_(run_state_wait),
+      clock_started_(false),
       clock_thread_(boost::bind(&mixer::run_clock, this)),
-      mixer_queue_(10),
-      mixer_state_(run_state_wait),
+      mixer_queue_(8),
+      mixer_stopped_(false),
+      workers_(get_cpu_thread_count(max_thread_count) - 1),
+      decoders_(create_raw_decoders(workers_.size())),
+      encoder_queue_(stage_queue_len),
+      output_queue_(stage_queue_len),
       mixer_thread_(boost::bind(&mixer::run_mixer, this)),
+      output_thread_(boost::bind(&mixer::run_output, this)),
       recorders_count_(0),
       monitor_(0)
 {
@@ -52,10 +107,18 @@ mixer::mixer()
     format_.sample_rate = dv_sample_rate_auto;
     settings_.video_mix = create_video_mix_simple(0);
     settings_.audio_source_id = 0;
+    settings_.audio_bus_count = 0;
     settings_.do_record = false;
     settings_.cut_before = false;
-    sources_.reserve(5);
     sinks_.reserve(5);
+
+    // Encode whole frames in parallel, one per CPU.  DV frames are
+    // encoded independently, so each thread has its own encoder
+    // context and takes whole frames in turn.
+    const unsigned encoder_count = get_cpu_thread_count(max_thread_count);
+    std::cout << "INFO: DV encoder threads: " << encoder_count << "\n";
+    for (unsigned i = 0; i != encoder_count; ++i)
+	encoder_threads_.create_thread(boost::bind(&mixer::run_encoder, this));
 }
 
 mixer::~mixer()
@@ -67,15 +130,38 @@ mixer::~mixer()
     }
     {
 	boost::mutex::scoped_lock lock(mixer_mutex_);
-	mixer_state_ = run_state_stop;
-	mixer_state_cond_.notify_one();
+	mixer_stopped_ = true;
     }
+    mixer_queue_event_.signal();
+    encoder_queue_.stop();
+    output_queue_.stop();
 
     clock_thread_.join();
     mixer_thread_.join();
+    encoder_threads_.join_all();
+    output_thread_.join();
+}
+
+mixer::source_data::source_data(source * src,
+				const source_settings & settings)
+    : frames(settings.max_queue_len),
+      target_queue_len(settings.min_queue_len),
+      src(src),
+      min_queue_len(settings.min_queue_len),
+      max_queue_len(settings.max_queue_len),
+      last_timestamp(0),
+      jitter(0),
+      arrival_interval(0),
+      shrink_count(0),
+      started(false),
+      drops(0),
+      repeats(0)
+{
+    assert(min_queue_len >= 1 && min_queue_len <= max_queue_len);
 }
 
-mixer::source_id mixer::add_source(source * src, const source_settings &)
+mixer::source_id mixer::add_source(source * src,
+				   const source_settings & settings)
 {
     boost::mutex::scoped_lock lock(source_mutex_);
     source_id id;
@@ -83,12 +169,11 @@ mixer::source_id mixer::add_source(source * src, const source_settings &)
     {
 	if (!sources_[id].src)
 	{
-	    sources_[id].src = src;
+	    sources_[id] = source_data(src, settings);
 	    return id;
 	}
     }
-    sources_.resize(id + 1);
-    sources_[id].src = src;
+    sources_.push_back(source_data(src, settings));
     return id;
 }
 
@@ -98,77 +183,170 @@ void mixer::remove_source(source_id id)
     sources_.at(id).src = NULL;
 }
 
-void mixer::put_frame(source_id id, const dv_frame_ptr & frame)
+namespace
 {
-    bool was_full;
-    bool should_notify_clock = false;
+    // Number of frames over which the jitter must stay low before
+    // a source's target queue length is reduced
+    const unsigned shrink_delay = 250;
+}
 
+void mixer::put_frame(source_id id, const dv_frame_ptr & frame)
+{
+    source_data * source_ptr;
     {
 	boost::mutex::scoped_lock lock(source_mutex_);
+	source_ptr = &sources_.at(id);
+    }
+    source_data & source = *source_ptr;
 
-	source_data & source = sources_.at(id);
-	was_full = source.frames.full();
+    const uint64_t timestamp = frame_timer_get();
+    frame->timestamp = timestamp;
 
-	if (!was_full)
+    // Update the smoothed mean deviation of arrival intervals from
+    // the nominal frame interval, as for RTP (RFC 3550)
+    if (source.last_timestamp)
+    {
+	const dv_system * system = dv_frame_system(frame.get());
+	const int64_t frame_interval =
+	    1000000000 / system->frame_rate_numer * system->frame_rate_denom;
+	int64_t deviation =
+	    int64_t(timestamp - source.last_timestamp) - frame_interval;
+	if (deviation < 0)
+	    deviation = -deviation;
+	// Don't let a long stall dominate (or overflow) the average
+	deviation = std::min<int64_t>(deviation, 1000000000);
+	unsigned jitter = source.jitter
+	    + (deviation - int64_t(source.jitter)) / 16;
+	__atomic_store_n(&source.jitter, jitter, __ATOMIC_RELAXED);
+
+	// Track the mean arrival interval much more slowly, to
+	// estimate the drift of the source's clock against ours.
+	// Ignore stalls.
+	const int64_t interval = timestamp - source.last_timestamp;
+	if (interval < 2 * frame_interval)
 	{
-	    frame->timestamp = frame_timer_get();
-	    source.frames.push(frame);
+	    int64_t arrival_interval =
+		source.arrival_interval ? source.arrival_interval
+		: frame_interval;
+	    arrival_interval += (interval - arrival_interval) / 256;
+	    __atomic_store_n(&source.arrival_interval,
+			     unsigned(arrival_interval), __ATOMIC_RELAXED);
+	}
 
-	    // Start clock ticking once first source has reached the
-	    // target queue length
-	    if (clock_state_ == run_state_wait
-		&& id == 0 && source.frames.size() == target_queue_len)
-	    {
-		clock_state_ = run_state_run;
-		should_notify_clock = true; // after we unlock the mutex
-	    }
+	// Allow for frames arriving up to 3 times the mean deviation
+	// late.  Increase the target immediately, but only reduce it
+	// once the jitter has stayed low for a while.
+	unsigned target =
+	    1 + (3 * uint64_t(jitter) + frame_interval - 1) / frame_interval;
+	target = std::max(source.min_queue_len,
+			  std::min(source.max_queue_len, target));
+	if (target < source.target_queue_len)
+	{
+	    if (++source.shrink_count < shrink_delay)
+		target = source.target_queue_len;
+	    else
+		target = source.target_queue_len - 1;
+	}
+	else
+	{
+	    source.shrink_count = 0;
+	}
+	if (target != source.target_queue_len)
+	{
+	    source.shrink_count = 0;
+	    __atomic_store_n(&source.target_queue_len, target,
+			     __ATOMIC_RELAXED);
+	    std::cerr << "INFO: Source " << 1 + id << " now buffering "
+		      << target << " frame(s)\n";
+	}
+    }
+    source.last_timestamp = timestamp;
 
-	    // Auto-select format
-	    if (clock_state_ == run_state_run)
-	    {
-		format_settings format;
-		format.system = dv_frame_system(frame.get());
-		format.frame_aspect = dv_frame_get_aspect(frame.get());
-		format.sample_rate = dv_frame_get_sample_rate(frame.get());
+    if (source.frames.size() >= source.max_queue_len
+	|| !source.frames.push(frame))
+    {
+	__atomic_add_fetch(&source.drops, 1, __ATOMIC_RELAXED);
+	std::cerr << "WARN: Dropped frame from source " << 1 + id
+		  << " due to full queue\n";
+	return;
+    }
 
-		frame->format_error = false;
+    // Start clock ticking once first source has reached its target
+    // queue length
+    if (!__atomic_load_n(&clock_started_, __ATOMIC_RELAXED) && id == 0
+	&& source.frames.size() >= source.target_queue_len)
+    {
+	{
+	    boost::mutex::scoped_lock lock(source_mutex_);
+	    if (clock_state_ == run_state_wait)
+		clock_state_ = run_state_run;
+	}
+	__atomic_store_n(&clock_started_, true, __ATOMIC_RELAXED);
+	clock_state_cond_.notify_one();
+    }
+}
 
-		if (format_.system == NULL)
-		    format_.system = format.system;
-		else if (format_.system != format.system)
-		{
-		    std::cerr << "WARN: Source " << 1 + id
-			      << " using wrong video system\n";
-		    frame->format_error = true;
-		}
+mixer::source_stats mixer::get_source_stats(source_id id)
+{
+    boost::mutex::scoped_lock lock(source_mutex_);
+    const source_data & source = sources_.at(id);
+    source_stats stats;
+    stats.queue_len = source.frames.size();
+    stats.target_queue_len =
+	__atomic_load_n(&source.target_queue_len, __ATOMIC_RELAXED);
+    stats.jitter_us =
+	__atomic_load_n(&source.jitter, __ATOMIC_RELAXED) / 1000;
+    stats.drift_ppm = 0;
+    unsigned arrival_interval =
+	__atomic_load_n(&source.arrival_interval, __ATOMIC_RELAXED);
+    if (arrival_interval && format_.system)
+    {
+	const int64_t frame_interval = 1000000000
+	    / format_.system->frame_rate_numer
+	    * format_.system->frame_rate_denom;
+	stats.drift_ppm = int((frame_interval - int64_t(arrival_interval))
+			      * 1000000 / arrival_interval);
+    }
+    stats.drops = __atomic_load_n(&source.drops, __ATOMIC_RELAXED);
+    stats.repeats = __atomic_load_n(&source.repeats, __ATOMIC_RELAXED);
+    return stats;
+}
 
-		if (format_.frame_aspect == dv_frame_aspect_auto)
-		    format_.frame_aspect = format.frame_aspect;
-		else if (format_.frame_aspect != format.frame_aspect)
-		    // Override frame aspect ratio
-		    dv_frame_set_aspect(frame.get(), format_.frame_aspect);
+void mixer::check_source_format(source_id id, dv_frame & frame)
+{
+    format_settings format;
+    format.system = dv_frame_system(&frame);
+    format.frame_aspect = dv_frame_get_aspect(&frame);
+    format.sample_rate = dv_frame_get_sample_rate(&frame);
 
-		if (format_.sample_rate == dv_sample_rate_auto &&
-		    format.sample_rate >= 0)
-		{
-		    format_.sample_rate = format.sample_rate;
-		}
-		else if (format_.sample_rate != format.sample_rate)
-		{
-		    std::cerr << "WARN: Source " << 1 + id
-			      << "using wrong sample rate\n";
-		    frame->format_error = true;
-		}
-	    }
-	}
+    frame.format_error = false;
+
+    if (format_.system == NULL)
+	format_.system = format.system;
+    else if (format_.system != format.system)
+    {
+	std::cerr << "WARN: Source " << 1 + id
+		  << " using wrong video system\n";
+	frame.format_error = true;
     }
 
-    if (should_notify_clock)
-	clock_state_cond_.notify_one();
+    if (format_.frame_aspect == dv_frame_aspect_auto)
+	format_.frame_aspect = format.frame_aspect;
+    else if (format_.frame_aspect != format.frame_aspect)
+	// Override frame aspect ratio
+	dv_frame_set_aspect(&frame, format_.frame_aspect);
 
-    if (was_full)
-	std::cerr << "WARN: Dropped frame from source " << 1 + id
-		  << " due to full queue\n";
+    if (format_.sample_rate == dv_sample_rate_auto &&
+	format.sample_rate >= 0)
+    {
+	format_.sample_rate = format.sample_rate;
+    }
+    else if (format_.sample_rate != format.sample_rate)
+    {
+	std::cerr << "WARN: Source " << 1 + id
+		  << "using wrong sample rate\n";
+	frame.format_error = true;
+    }
 }
 
 mixer::sink_id mixer::add_sink(sink * sink, bool will_record)
@@ -215,6 +393,38 @@ void mixer::set_audio_source(source_id id)
 	throw std::range_error("audio source id out of range");
 }
 
+void mixer::set_audio_gain(source_id id, unsigned gain)
+{
+    if (gain > PCM_GAIN_MAX)
+	throw std::range_error("audio gain out of range");
+
+    boost::mutex::scoped_lock lock(source_mutex_);
+    if (id >= sources_.size())
+	throw std::range_error("audio source id out of range");
+
+    audio_bus_input * const bus = settings_.audio_bus;
+    unsigned & count = settings_.audio_bus_count;
+    unsigned i = 0;
+    while (i != count && bus[i].id != id)
+	++i;
+
+    if (gain == 0 && id != settings_.audio_source_id)
+    {
+	// Remove the input, if present
+	if (i != count)
+	    bus[i] = bus[--count];
+	return;
+    }
+
+    if (i == count)
+    {
+	if (count == max_audio_bus_inputs)
+	    throw std::range_error("too many audio bus inputs");
+	bus[count++].id = id;
+    }
+    bus[i].gain = gain;
+}
+
 void mixer::set_monitor(monitor * monitor)
 {
     assert(monitor && !monitor_);
@@ -265,12 +475,18 @@ void mixer::run_clock()
     unsigned int frame_interval = 0;
     // Weighted rolling average frame interval
     unsigned int average_frame_interval = 0;
+    // Target queue length for the audio source
+    unsigned int audio_target_len = 1;
+
+    // This is swapped with a recycled mix_data on each tick
+    mix_data m;
+    record_time_packs record_time;
 
     for (uint64_t tick_timestamp = frame_timer_get();
 	 ;
 	 tick_timestamp += frame_interval, frame_timer_wait(tick_timestamp))
     {
-	mix_data m;
+	m.clear();
 
 	// Select the mixer settings and source frame(s)
 	{
@@ -279,25 +495,68 @@ void mixer::run_clock()
 	    if (clock_state_ == run_state_stop)
 		break;
 
-	    m.format = format_;
 	    m.settings = settings_;
 	    settings_.cut_before = false;
 
 	    m.source_frames.resize(sources_.size());
 	    for (source_id id = 0; id != sources_.size(); ++id)
 	    {
-		if (sources_[id].frames.empty())
+		source_data & source = sources_[id];
+		dv_frame_ptr & frame = m.source_frames[id];
+		if (source.frames.pop_swap(frame))
 		{
-		    m.source_frames[id].reset();
+		    // If the queue has grown 2 or more frames past
+		    // its target, skip ahead.  The audio source is
+		    // left alone as the clock rate follows it.  The
+		    // skipped frames are passed on for their audio.
+		    if (id != m.settings.audio_source_id)
+		    {
+			unsigned target = __atomic_load_n(
+			    &source.target_queue_len, __ATOMIC_RELAXED);
+			while (source.frames.size() > target)
+			{
+			    m.skipped_frames.resize(
+				m.skipped_frames.size() + 1);
+			    mix_data::skipped_frame & skipped =
+				m.skipped_frames.back();
+			    skipped.id = id;
+			    skipped.frame.swap(frame);
+			    source.frames.pop_swap(frame);
+			    __atomic_add_fetch(&source.drops, 1,
+					       __ATOMIC_RELAXED);
+			}
+		    }
+		    check_source_format(id, *frame);
+		    source.started = true;
 		}
-		else
+		else if (source.src && source.started)
 		{
-		    m.source_frames[id] = sources_[id].frames.front();
-		    sources_[id].frames.pop();
+		    __atomic_add_fetch(&source.repeats, 1, __ATOMIC_RELAXED);
 		}
 	    }
+	    if (m.settings.audio_source_id < sources_.size())
+		audio_target_len = __atomic_load_n(
+		    &sources_[m.settings.audio_source_id].target_queue_len,
+		    __ATOMIC_RELAXED);
+
+	    m.source_rates.resize(sources_.size());
+	    for (source_id id = 0; id != sources_.size(); ++id)
+	    {
+		unsigned arrival_interval = __atomic_load_n(
+		    &sources_[id].arrival_interval, __ATOMIC_RELAXED);
+		m.source_rates[id] =
+		    arrival_interval && average_frame_interval
+		    ? double(average_frame_interval) / arrival_interval
+		    : 1.0;
+	    }
+
+	    // Auto-selected format may have been changed by the above
+	    m.format = format_;
 	}
 
+	record_time.set_time(std::time(0));
+	m.record_time = record_time;
+
 	assert(m.settings.audio_source_id < m.source_frames.size());
 
 	// Frame timer is based on the audio source.  Synchronisation
@@ -330,15 +589,17 @@ void mixer::run_clock()
 		static const unsigned average_rolling_weight = 15;
 		static const unsigned average_next_weight = 1;
 
-		// Try to keep target_queue_len - 0.5 frame intervals
+		// Try to keep audio_target_len - 0.5 frame intervals
 		// between delivery of source frames and mixing them.
 		// The "obvious" way to feed the delay into the
-		// frame_time is to divide it by target_queue_len-0.5.
+		// frame_time is to divide it by audio_target_len-0.5.
 		// But this is inverse to the effect we want it to
 		// have: if the delay is long, we need to reduce,
 		// not increase, frame_time.  So we calculate a kind
 		// of inverse based on the amount of queue space
-		// that should remain free.
+		// that should remain free, taking the full queue
+		// length to be twice the target.
+		const unsigned full_queue_len = audio_target_len * 2;
 		const uint64_t delay =
 		    tick_timestamp > audio_source_frame->timestamp
 		    ? tick_timestamp - audio_source_frame->timestamp
@@ -350,7 +611,7 @@ void mixer::run_clock()
 		frame_interval =
 		    (average_frame_interval * next_average_weight
 		     + (free_queue_time
-			* 2 / (2 * (full_queue_len - target_queue_len) + 1)
+			* 2 / (2 * (full_queue_len - audio_target_len) + 1)
 			* next_delay_weight))
 		    / (next_average_weight + next_delay_weight);
 
@@ -361,21 +622,9 @@ void mixer::run_clock()
 	    }
 	}
 
-	std::size_t free_len;
-
-	{
-	    boost::mutex::scoped_lock lock(mixer_mutex_);
-	    free_len = mixer_queue_.capacity() - mixer_queue_.size();
-	    if (free_len != 0)
-	    {
-		mixer_queue_.push(m); // really want to move m here
-		mixer_state_ = run_state_run;
-	    }
-	}
-
-	if (free_len != 0)
+	if (mixer_queue_.push_swap(m))
 	{
-	    mixer_state_cond_.notify_one();
+	    mixer_queue_event_.signal();
 	}
 	else
 	{
@@ -400,6 +649,22 @@ namespace
 	return result;
     }
 
+    bool rectangles_equal(const rectangle & a, const rectangle & b)
+    {
+	return a.left == b.left && a.top == b.top
+	    && a.right == b.right && a.bottom == b.bottom;
+    }
+
+    rectangle get_lowres_rect(const rectangle & rect, unsigned lowres)
+    {
+	rectangle result;
+	result.left = rect.left >> lowres;
+	result.top = rect.top >> lowres;
+	result.right = rect.right >> lowres;
+	result.bottom = rect.bottom >> lowres;
+	return result;
+    }
+
     raw_frame_ptr decode_video_frame(
  	const auto_codec & decoder, const dv_frame_ptr & dv_frame)
     {
@@ -424,169 +689,351 @@ namespace
 	return result;
     }
 
+    // Make a private copy of a raw frame, so that it can be modified
+    // by an effect while the original remains shared.
+    raw_frame_ptr copy_video_frame(const raw_frame_ptr & source)
+    {
+	raw_frame_ptr result = allocate_raw_frame();
+	raw_frame_init_planes(result.get(), source->pix_fmt);
+	copy_raw_frame(make_raw_frame_ref(result), make_raw_frame_ref(source));
+	result->header.opaque = source->header.opaque;
+	result->aspect = source->aspect;
+	return result;
+    }
+
+    // Return the boundary between bands i-1 and i when dividing a
+    // frame of the given height into count bands.  Bands are a whole
+    // number of macroblock rows, so they are also aligned for any
+    // chroma subsampling.
+    unsigned get_band_bound(unsigned height, unsigned i, unsigned count)
+    {
+	return (i == count) ? height : (height / 16 * i / count) * 16;
+    }
+
+    // Check whether video_effect_pic_in_pic() can scale source_rect
+    // down to dest_rect, after rounding them for the given chroma
+    // subsampling
+    bool pic_in_pic_fits(const rectangle & source_rect,
+			 const rectangle & dest_rect,
+			 unsigned chroma_shift_horiz, unsigned chroma_shift_vert)
+    {
+	const int mask_horiz = -(1 << chroma_shift_horiz);
+	const int mask_vert = -(1 << chroma_shift_vert);
+	return ((source_rect.right & mask_horiz) - (source_rect.left & mask_horiz)
+		>= (dest_rect.right & mask_horiz) - (dest_rect.left & mask_horiz)
+		&& ((source_rect.bottom & mask_vert)
+		    - (source_rect.top & mask_vert))
+		>= (dest_rect.bottom & mask_vert) - (dest_rect.top & mask_vert));
+    }
+
+    // Return the greatest reduction in resolution (as a power of 2)
+    // at which the source region is still at least as large as the
+    // destination region, so that picture-in-picture only has to
+    // scale down.  The decoder produces 4:2:0 or 4:1:1 depending on
+    // the source, so this must allow for both.
+    unsigned get_pic_in_pic_lowres(const rectangle & source_rect,
+				   const rectangle & dest_rect)
+    {
+	for (unsigned lowres = max_lowres; lowres != 0; --lowres)
+	{
+	    rectangle lowres_rect = get_lowres_rect(source_rect, lowres);
+	    if (pic_in_pic_fits(lowres_rect, dest_rect, 1, 1)
+		&& pic_in_pic_fits(lowres_rect, dest_rect, 2, 0))
+		return lowres;
+	}
+	return 0;
+    }
+
     inline unsigned bcd(unsigned v)
     {
 	assert(v < 100);
 	return ((v / 10) << 4) + v % 10;
     }
 
-    void set_times(dv_frame & dv_frame)
+    enum pack_type
+    {
+	pack_timecode,
+	pack_video_date,
+	pack_video_time,
+	pack_audio_date,
+	pack_audio_time
+    };
+
+    struct pack_location
     {
-	// XXX We should work this out in the clock loop.
-	time_t now;
-	time(&now);
-	tm now_tm;
-	localtime_r(&now, &now_tm);
+	unsigned offset;
+	pack_type type;
+    };
 
-	// Generate nominal frame count and frame rate.
-	unsigned frame_num = dv_frame.serial_num;
-	unsigned frame_rate;
-	if (dv_frame.buffer[3] & 0x80)
+    // Offsets of the timecode and record date/time packs in a frame
+    // of each system, so that writing them is a simple loop
+    class pack_location_table
+    {
+    public:
+	pack_location_table()
 	{
-	    frame_rate = 25;
+	    build(locations_625_50_, dv_system_625_50);
+	    build(locations_525_60_, dv_system_525_60);
 	}
-	else
+
+	const std::vector<pack_location> &
+	get(const dv_system * system) const
+	{
+	    return system == &dv_system_625_50
+		? locations_625_50_ : locations_525_60_;
+	}
+
+    private:
+	static void add(std::vector<pack_location> & locations,
+			unsigned offset, pack_type type)
 	{
-	    // Skip the first 2 frame numbers of each minute, except in
-	    // minutes divisible by 10.  This results in a "drop frame
-	    // timecode" with a nominal frame rate of 30 Hz.
-	    frame_num = frame_num + 2 * frame_num / (60 * 30 - 2)
-		- 2 * (frame_num + 2) / (10 * 60 * 30 - 18);
-	    frame_rate = 30;
+	    pack_location location = { offset, type };
+	    locations.push_back(location);
 	}
 
-	// Timecode format is based on SMPTE LTC
-	// <http://en.wikipedia.org/wiki/Linear_timecode>:
-	// 0: pack id = 0x13
-	// 1: LTC bits 0-3, 8-11
-	//    bits 0-5: frame part (BCD)
-	//    bit 6: drop frame timecode flag
-	// 2: LTC bits 16-19, 24-27
-	//    bits 0-6: second part (BCD)
-	// 3: LTC bits 32-35, 40-43
-	//    bits 0-6: minute part (BCD)
-	// 4: LTC bits 48-51, 56-59
-	//    bits 0-5: hour part (BCD)
-	// the remaining bits are meaningless in DV and we use zeroes
-	uint8_t timecode[DIF_PACK_SIZE] = {
-	    0x13,
-	    (uint8_t)bcd(frame_num % frame_rate) | (1 << 6),
-	    (uint8_t)bcd(frame_num / frame_rate % 60),
-	    (uint8_t)bcd(frame_num / (60 * frame_rate) % 60),
-	    (uint8_t)bcd(frame_num / (60 * 60 * frame_rate) % 24)
-	};
-
-	// Record date format:
-	// 0: pack id = 0x62 (video) or 0x52 (audio)
-	// 1: some kind of time zone indicator or 0xff for unknown
-	// 2: bits 6-7: unused? reserved?
-	//    bits 0-5: day part (BCD)
-	// 3: bits 5-7: unused? reserved? day of week?
-	//    bits 0-4: month part (BCD)
-	// 4: year part (BCD)
-	uint8_t video_record_date[DIF_PACK_SIZE] = {
-	    0x62,
-	    0xff,
-	    (uint8_t)bcd(now_tm.tm_mday),
-	    (uint8_t)bcd(1 + now_tm.tm_mon),
-	    (uint8_t)bcd(now_tm.tm_year % 100)
-	};
-	uint8_t audio_record_date[DIF_PACK_SIZE] = {
-	    0x52,
-	    0xff,
-	    (uint8_t)bcd(now_tm.tm_mday),
-	    (uint8_t)bcd(1 + now_tm.tm_mon),
-	    (uint8_t)bcd(now_tm.tm_year % 100)
-	};
-
-	// Record time format (similar to timecode format):
-	// 0: pack id = 0x63 (video) or 0x53 (audio)
-	// 1: bits 6-7: reserved, set to 1
-	//    bits 0-5: frame part (BCD) or 0x3f for unknown
-	// 2: bit 7: unused? reserved?
-	//    bits 0-6: second part (BCD)
-	// 3: bit 7: unused? reserved?
-	//    bits 0-6: minute part (BCD)
-	// 4: bits 6-7: unused? reserved?
-	//    bits 0-5: hour part (BCD)
-	uint8_t video_record_time[DIF_PACK_SIZE] = {
-	    0x63,
-	    0xff,
-	    (uint8_t)bcd(now_tm.tm_sec),
-	    (uint8_t)bcd(now_tm.tm_min),
-	    (uint8_t)bcd(now_tm.tm_hour)
-	};
-	uint8_t audio_record_time[DIF_PACK_SIZE] = {
-	    0x53,
-	    0xff,
-	    (uint8_t)bcd(now_tm.tm_sec),
-	    (uint8_t)bcd(now_tm.tm_min),
-	    (uint8_t)bcd(now_tm.tm_hour)
-	};
-
-        // In DIFs 1 and 2 (subcode) of sequence 6 onward:
-	// - Write timecode at offset 6 and 30
-	// - Write video record date at offset 14 and 38
-	// - Write video record time at offset 22 and 46
-	// In DIFs 3, 4 and 5 (VAUX) of even sequences:
-	// - Write video record date at offset 13 and 58
-	// - Write video record time at offset 18 and 63
-	// In DIF 86 of even sequences and DIF 38 of odd sequences (AAUX):
-	// - Write audio record date at offset 3
-	// In DIF 102 of even sequences and DIF 54 of odd sequences (AAUX):
-	// - Write audio record time at offset 3
-
-	for (unsigned seq_num = 0;
-	     seq_num != dv_frame_system(&dv_frame)->seq_count;
-	     ++seq_num)
+	static void build(std::vector<pack_location> & locations,
+			  const dv_system & system)
 	{
-	    if (seq_num >= 6)
+	    // In DIFs 1 and 2 (subcode) of sequence 6 onward:
+	    // - Write timecode at offset 6 and 30
+	    // - Write video record date at offset 14 and 38
+	    // - Write video record time at offset 22 and 46
+	    // In DIFs 3, 4 and 5 (VAUX) of even sequences:
+	    // - Write video record date at offset 13 and 58
+	    // - Write video record time at offset 18 and 63
+	    // In DIF 86 of even sequences and DIF 38 of odd sequences (AAUX):
+	    // - Write audio record date at offset 3
+	    // In DIF 102 of even sequences and DIF 54 of odd sequences (AAUX):
+	    // - Write audio record time at offset 3
+
+	    for (unsigned seq_num = 0; seq_num != system.seq_count; ++seq_num)
 	    {
-		for (unsigned block_num = 1; block_num <= 3; ++block_num)
+		unsigned seq_offset = seq_num * DIF_SEQUENCE_SIZE;
+
+		if (seq_num >= 6)
 		{
-		    for (unsigned i = 0; i <= 1; ++i)
+		    for (unsigned block_num = 1; block_num <= 3; ++block_num)
 		    {
-			memcpy(dv_frame.buffer + seq_num * DIF_SEQUENCE_SIZE
-			       + block_num * DIF_BLOCK_SIZE + i * 24 + 6,
-			       timecode,
-			       DIF_PACK_SIZE);
-			memcpy(dv_frame.buffer + seq_num * DIF_SEQUENCE_SIZE
-			       + block_num * DIF_BLOCK_SIZE + i * 24 + 14,
-			       video_record_date,
-			       DIF_PACK_SIZE);
-			memcpy(dv_frame.buffer + seq_num * DIF_SEQUENCE_SIZE
-			       + block_num * DIF_BLOCK_SIZE + i * 24 + 22,
-			       video_record_time,
-			       DIF_PACK_SIZE);
+			for (unsigned i = 0; i <= 1; ++i)
+			{
+			    unsigned offset = seq_offset
+				+ block_num * DIF_BLOCK_SIZE + i * 24;
+			    add(locations, offset + 6, pack_timecode);
+			    add(locations, offset + 14, pack_video_date);
+			    add(locations, offset + 22, pack_video_time);
+			}
 		    }
 		}
-	    }
 
-	    for (unsigned block_num = 3; block_num <= 5; ++block_num)
-	    {
-		for (unsigned i = 0; i <= 1; ++i)
+		for (unsigned block_num = 3; block_num <= 5; ++block_num)
 		{
-		    memcpy(dv_frame.buffer + seq_num * DIF_SEQUENCE_SIZE
-			   + block_num * DIF_BLOCK_SIZE + i * 45 + 13,
-			   video_record_date,
-			   DIF_PACK_SIZE);
-		    memcpy(dv_frame.buffer + seq_num * DIF_SEQUENCE_SIZE
-			   + block_num * DIF_BLOCK_SIZE + i * 45 + 18,
-			   video_record_time,
-			   DIF_PACK_SIZE);
+		    for (unsigned i = 0; i <= 1; ++i)
+		    {
+			unsigned offset = seq_offset
+			    + block_num * DIF_BLOCK_SIZE + i * 45;
+			add(locations, offset + 13, pack_video_date);
+			add(locations, offset + 18, pack_video_time);
+		    }
 		}
-	    }
 
-	    memcpy(dv_frame.buffer + seq_num * DIF_SEQUENCE_SIZE
-		   + ((seq_num & 1) ? 38 : 86) * DIF_BLOCK_SIZE + 3,
-		   audio_record_date,
-		   DIF_PACK_SIZE);
-	    memcpy(dv_frame.buffer + seq_num * DIF_SEQUENCE_SIZE
-		   + ((seq_num & 1) ? 54 : 102) * DIF_BLOCK_SIZE + 3,
-		   audio_record_time,
-		   DIF_PACK_SIZE);
+		add(locations,
+		    seq_offset + ((seq_num & 1) ? 38 : 86) * DIF_BLOCK_SIZE + 3,
+		    pack_audio_date);
+		add(locations,
+		    seq_offset + ((seq_num & 1) ? 54 : 102) * DIF_BLOCK_SIZE + 3,
+		    pack_audio_time);
+	    }
 	}
+
+	std::vector<pack_location> locations_625_50_;
+	std::vector<pack_location> locations_525_60_;
+    };
+
+    const pack_location_table pack_locations;
+}
+
+void mixer::record_time_packs::set_time(std::time_t now)
+{
+    if (now == time)
+	return;
+    time = now;
+
+    tm now_tm;
+    localtime_r(&now, &now_tm);
+
+    // Record date format:
+    // 0: pack id = 0x62 (video) or 0x52 (audio)
+    // 1: some kind of time zone indicator or 0xff for unknown
+    // 2: bits 6-7: unused? reserved?
+    //    bits 0-5: day part (BCD)
+    // 3: bits 5-7: unused? reserved? day of week?
+    //    bits 0-4: month part (BCD)
+    // 4: year part (BCD)
+    video_date[0] = 0x62;
+    video_date[1] = 0xff;
+    video_date[2] = bcd(now_tm.tm_mday);
+    video_date[3] = bcd(1 + now_tm.tm_mon);
+    video_date[4] = bcd(now_tm.tm_year % 100);
+    std::memcpy(audio_date, video_date, DIF_PACK_SIZE);
+    audio_date[0] = 0x52;
+
+    // Record time format (similar to timecode format):
+    // 0: pack id = 0x63 (video) or 0x53 (audio)
+    // 1: bits 6-7: reserved, set to 1
+    //    bits 0-5: frame part (BCD) or 0x3f for unknown
+    // 2: bit 7: unused? reserved?
+    //    bits 0-6: second part (BCD)
+    // 3: bit 7: unused? reserved?
+    //    bits 0-6: minute part (BCD)
+    // 4: bits 6-7: unused? reserved?
+    //    bits 0-5: hour part (BCD)
+    video_time[0] = 0x63;
+    video_time[1] = 0xff;
+    video_time[2] = bcd(now_tm.tm_sec);
+    video_time[3] = bcd(now_tm.tm_min);
+    video_time[4] = bcd(now_tm.tm_hour);
+    std::memcpy(audio_time, video_time, DIF_PACK_SIZE);
+    audio_time[0] = 0x53;
+}
+
+void mixer::record_time_packs::write(dv_frame & dv_frame) const
+{
+    // Generate nominal frame count and frame rate.
+    unsigned frame_num = dv_frame.serial_num;
+    unsigned frame_rate;
+    if (dv_frame.buffer[3] & 0x80)
+    {
+	frame_rate = 25;
+    }
+    else
+    {
+	// Skip the first 2 frame numbers of each minute, except in
+	// minutes divisible by 10.  This results in a "drop frame
+	// timecode" with a nominal frame rate of 30 Hz.
+	frame_num = frame_num + 2 * frame_num / (60 * 30 - 2)
+	    - 2 * (frame_num + 2) / (10 * 60 * 30 - 18);
+	frame_rate = 30;
+    }
+
+    // Timecode format is based on SMPTE LTC
+    // <http://en.wikipedia.org/wiki/Linear_timecode>:
+    // 0: pack id = 0x13
+    // 1: LTC bits 0-3, 8-11
+    //    bits 0-5: frame part (BCD)
+    //    bit 6: drop frame timecode flag
+    // 2: LTC bits 16-19, 24-27
+    //    bits 0-6: second part (BCD)
+    // 3: LTC bits 32-35, 40-43
+    //    bits 0-6: minute part (BCD)
+    // 4: LTC bits 48-51, 56-59
+    //    bits 0-5: hour part (BCD)
+    // the remaining bits are meaningless in DV and we use zeroes
+    uint8_t timecode[DIF_PACK_SIZE] = {
+	0x13,
+	(uint8_t)(bcd(frame_num % frame_rate) | (1 << 6)),
+	(uint8_t)bcd(frame_num / frame_rate % 60),
+	(uint8_t)bcd(frame_num / (60 * frame_rate) % 60),
+	(uint8_t)bcd(frame_num / (60 * 60 * frame_rate) % 24)
+    };
+
+    // Indexed by pack_type
+    const uint8_t * const packs[] = {
+	timecode, video_date, video_time, audio_date, audio_time
+    };
+
+    const std::vector<pack_location> & locations =
+	pack_locations.get(dv_frame_system(&dv_frame));
+    for (std::size_t i = 0; i != locations.size(); ++i)
+	std::memcpy(dv_frame.buffer + locations[i].offset,
+		    packs[locations[i].type], DIF_PACK_SIZE);
+}
+
+const raw_frame_ptr &
+mixer::mix_data::decode_source(source_id id, const auto_codec & decoder) const
+{
+    const dv_frame_ptr & source_dv = source_frames[id];
+    assert(source_dv);
+    assert(source_raw_frames.size() == source_frames.size());
+
+    raw_frame_ptr & source_raw = source_raw_frames[id];
+    if (!source_raw || source_raw->header.pts != source_dv->serial_num)
+    {
+	source_raw = decode_video_frame(decoder, source_dv);
+	source_raw->header.pts = source_dv->serial_num;
     }
+    return source_raw;
+}
+
+void mixer::mix_data::clear()
+{
+    source_frames.clear();
+    source_raw_frames.clear();
+    source_rates.clear();
+    skipped_frames.clear();
+    settings.video_mix.reset();
+}
+
+void mixer::mix_data::swap(mix_data & other)
+{
+    source_frames.swap(other.source_frames);
+    std::swap(format, other.format);
+    std::swap(settings, other.settings);
+    std::swap(record_time, other.record_time);
+    source_rates.swap(other.source_rates);
+    skipped_frames.swap(other.skipped_frames);
+    source_raw_frames.swap(other.source_raw_frames);
+}
+
+void mixer::mix_result::clear()
+{
+    data.clear();
+    mixed_raw.reset();
+    mixed_dv.reset();
+    base_dv.reset();
+}
+
+void mixer::mix_result::swap(mix_result & other)
+{
+    data.swap(other.data);
+    std::swap(serial_num, other.serial_num);
+    mixed_raw.swap(other.mixed_raw);
+    mixed_dv.swap(other.mixed_dv);
+    base_dv.swap(other.base_dv);
+    std::swap(changed_region, other.changed_region);
+}
+
+void mixer::decode_source_task(const mix_data * m, source_id id,
+			       const auto_codec * decoders, unsigned worker)
+{
+    m->decode_source(id, decoders[worker]);
+}
+
+void mixer::decode_frame_task(const dv_frame_ptr * dv_frame,
+			      raw_frame_ptr * raw_frame,
+			      const auto_codec * decoders, unsigned worker)
+{
+    *raw_frame = decode_video_frame(decoders[worker], *dv_frame);
+}
+
+const auto_codec * mixer::get_decoders(unsigned lowres) const
+{
+    assert(lowres <= max_lowres);
+    return &decoders_[lowres * workers_.size()];
+}
+
+void mixer::decode_sources(const mix_data & m,
+			   const source_id * ids, std::size_t count)
+{
+    std::vector<worker_pool::task> tasks;
+    tasks.reserve(count);
+    for (std::size_t i = 0; i != count; ++i)
+    {
+	// Each source only needs to be decoded once
+	if (std::find(ids, ids + i, ids[i]) == ids + i)
+	    tasks.push_back(boost::bind(&mixer::decode_source_task, &m, ids[i],
+					get_decoders(0), _1));
+    }
+    workers_.run(tasks);
 }
 
 void mixer::set_video_mix(std::tr1::shared_ptr<video_mix> video_mix)
@@ -609,8 +1056,7 @@ public:
 private:
     virtual void validate(const mixer &);
     virtual void set_active(const mixer &, bool active);
-    virtual bool apply(const mix_data &, const auto_codec &,
-		       raw_frame_ptr &, dv_frame_ptr &);
+    virtual bool apply(mixer &, const mix_data &, mix_result &);
     virtual void status(mixer::monitor *) {}
     source_id source_id_;
 };
@@ -628,13 +1074,13 @@ void mixer::video_mix_simple::set_active(const mixer & mixer, bool active)
 	    active ? source_active_video : source_active_none);
 }
 
-bool mixer::video_mix_simple::apply(const mix_data & m, const auto_codec &,
-				    raw_frame_ptr &, dv_frame_ptr & mixed_dv)
+bool mixer::video_mix_simple::apply(mixer &, const mix_data & m,
+				    mix_result & result)
 {
     const dv_frame_ptr & source_dv = m.source_frames[source_id_];
 
     if (source_dv && dv_frame_system(source_dv.get()) == m.format.system)
-	mixed_dv = source_dv;
+	result.mixed_dv = source_dv;
     return false;
 }
 
@@ -653,11 +1099,12 @@ public:
 private:
     virtual void validate(const mixer &);
     virtual void set_active(const mixer &, bool active);
-    virtual bool apply(const mix_data &, const auto_codec &,
-		       raw_frame_ptr &, dv_frame_ptr &);
+    virtual bool apply(mixer &, const mix_data &, mix_result &);
     virtual void status(mixer::monitor *) {}
     source_id pri_source_id_, sec_source_id_;
     rectangle dest_region_;
+    // Scaling tables for the current source format
+    boost::scoped_ptr<video_effect_pic_in_pic_scaler> scaler_;
 };
 
 void mixer::video_mix_pic_in_pic::validate(const mixer & mixer)
@@ -677,10 +1124,9 @@ void mixer::video_mix_pic_in_pic::set_active(const mixer & mixer, bool active)
 	    active ? source_active_video : source_active_none);
 }
 
-bool mixer::video_mix_pic_in_pic::apply(const mix_data & m,
-					const auto_codec & decoder,
-					raw_frame_ptr & mixed_raw,
-					dv_frame_ptr &)
+bool mixer::video_mix_pic_in_pic::apply(mixer & mixer,
+					const mix_data & m,
+					mix_result & result)
 {
     const dv_frame_ptr & pri_source_dv = m.source_frames[pri_source_id_];
     const dv_frame_ptr & sec_source_dv = m.source_frames[sec_source_id_];
@@ -690,16 +1136,54 @@ bool mixer::video_mix_pic_in_pic::apply(const mix_data & m,
 	sec_source_dv &&
 	dv_frame_system(sec_source_dv.get()) == m.format.system)
     {
-	// Decode sources
-	mixed_raw = decode_video_frame(decoder, pri_source_dv);
-	raw_frame_ptr sec_source_raw =
-	    decode_video_frame(decoder, sec_source_dv);
+	// Decode sources.  The secondary source only needs to be
+	// decoded at the lowest resolution that is no smaller than
+	// the destination region.  This is a private decoding that
+	// is not added to the cache.
+	const rectangle & active_region = m.format.system->active_region;
+	const unsigned lowres =
+	    get_pic_in_pic_lowres(active_region, dest_region_);
+	raw_frame_ptr sec_source_raw;
+	std::vector<worker_pool::task> tasks;
+	tasks.reserve(std::max(2U, mixer.workers_.size()));
+	tasks.push_back(
+	    boost::bind(&mixer::decode_source_task, &m, pri_source_id_,
+			mixer.get_decoders(0), _1));
+	tasks.push_back(
+	    boost::bind(&mixer::decode_frame_task, &sec_source_dv,
+			&sec_source_raw, mixer.get_decoders(lowres), _1));
+	mixer.workers_.run(tasks);
+	result.mixed_raw =
+	    copy_video_frame(m.source_raw_frames[pri_source_id_]);
+
+	raw_frame_ref sec = make_raw_frame_ref(sec_source_raw);
+	sec.height >>= lowres;
+
+	const raw_frame_ref dest = make_raw_frame_ref(result.mixed_raw);
+	const rectangle source_rect = get_lowres_rect(active_region, lowres);
+	if (!scaler_ || scaler_->pix_fmt != dest.pix_fmt
+	    || !rectangles_equal(scaler_->s_rect, source_rect))
+	{
+	    if (!scaler_)
+		scaler_.reset(new video_effect_pic_in_pic_scaler);
+	    video_effect_pic_in_pic_scaler_init(scaler_.get(), dest.pix_fmt,
+						dest_region_, source_rect);
+	}
 
-	// Mix raw video
-	video_effect_pic_in_pic(
-	    make_raw_frame_ref(mixed_raw), dest_region_,
-	    make_raw_frame_ref(sec_source_raw),
-	    raw_frame_system(sec_source_raw.get())->active_region);
+	// Mix raw video, in bands
+	const unsigned band_count = mixer.workers_.size();
+	tasks.clear();
+	for (unsigned i = 0; i != band_count; ++i)
+	    tasks.push_back(
+		boost::bind(video_effect_pic_in_pic_scaler_band,
+			    scaler_.get(), dest, sec,
+			    get_band_bound(dest.height, i, band_count),
+			    get_band_bound(dest.height, i + 1, band_count)));
+	mixer.workers_.run(tasks);
+
+	// Only the inset needs to be encoded again
+	result.base_dv = pri_source_dv;
+	result.changed_region = dest_region_;
     }
     return false;
 }
@@ -720,15 +1204,17 @@ public:
 	  scale_(scale),
 	  bucketsize_(ms * 1000 / 255),
 	  modulo_(0),
-	  us_per_frame_(0)
+	  us_per_frame_(0),
+	  finished_(false)
     {}
     uint8_t get_scale() { return scale_; };
 
 private:
     virtual void validate(const mixer &);
     virtual void set_active(const mixer &, bool active);
-    virtual bool apply(const mix_data &, const auto_codec &, raw_frame_ptr &, dv_frame_ptr &);
+    virtual bool apply(mixer &, const mix_data &, mix_result &);
     virtual void status(mixer::monitor * monitor);
+    virtual std::tr1::shared_ptr<video_mix> get_successor() const;
 
     source_id pri_source_id_, sec_source_id_;
     bool timed_;
@@ -736,6 +1222,7 @@ private:
     int bucketsize_;
     int modulo_;
     int us_per_frame_;
+    bool finished_;
 };
 
 void mixer::video_mix_fade::validate(const mixer & mixer)
@@ -762,10 +1249,9 @@ void mixer::video_mix_fade::status(mixer::monitor * monitor)
     monitor->effect_status(0, scale_, 255, timed_);
 }
 
-bool mixer::video_mix_fade::apply(const mix_data & m,
-				  const auto_codec & decoder,
-				  raw_frame_ptr & mixed_raw,
-				  dv_frame_ptr &)
+bool mixer::video_mix_fade::apply(mixer & mixer,
+				  const mix_data & m,
+				  mix_result & result)
 {
     bool retval = false;
     const dv_frame_ptr & pri_source_dv = m.source_frames[pri_source_id_];
@@ -786,6 +1272,7 @@ bool mixer::video_mix_fade::apply(const mix_data & m,
 	if ((scale_ + step) >= 255)
 	{
 	    timed_ = false;
+	    finished_ = true;
 	    scale_ = 255;
 	}
 	else
@@ -793,23 +1280,63 @@ bool mixer::video_mix_fade::apply(const mix_data & m,
 	    scale_ += step;
 	}
     }
+
+    // At either end of the fade the output is just one of the
+    // sources, so pass its DV frame through rather than decoding
+    // and re-encoding it.  (A full-scale fade is 255/256 of the
+    // way to the secondary source, which we treat as all the way.)
+    if (scale_ == 0 || scale_ == 255)
+    {
+	const dv_frame_ptr & source_dv =
+	    scale_ == 0 ? pri_source_dv : sec_source_dv;
+	if (source_dv && dv_frame_system(source_dv.get()) == m.format.system)
+	    result.mixed_dv = source_dv;
+	return retval;
+    }
+
     if (pri_source_dv &&
 	dv_frame_system(pri_source_dv.get()) == m.format.system &&
 	sec_source_dv &&
 	dv_frame_system(sec_source_dv.get()) == m.format.system)
     {
 	// Decode sources
-	mixed_raw = decode_video_frame(decoder, pri_source_dv);
-	raw_frame_ptr sec_source_raw =
-	    decode_video_frame(decoder, sec_source_dv);
-
-	// Mix raw video
-	video_effect_fade(make_raw_frame_ref(mixed_raw),
-			  make_raw_frame_ref(sec_source_raw), scale_);
+	const source_id ids[2] = { pri_source_id_, sec_source_id_ };
+	mixer.decode_sources(m, ids, 2);
+	result.mixed_raw =
+	    copy_video_frame(m.source_raw_frames[pri_source_id_]);
+	const raw_frame_ptr & sec_source_raw =
+	    m.source_raw_frames[sec_source_id_];
+
+	// Mix raw video, in bands
+	const raw_frame_ref dest = make_raw_frame_ref(result.mixed_raw);
+	const raw_frame_ref sec = make_raw_frame_ref(sec_source_raw);
+	const unsigned band_count = mixer.workers_.size();
+	std::vector<worker_pool::task> tasks;
+	tasks.reserve(band_count);
+	for (unsigned i = 0; i != band_count; ++i)
+	{
+	    unsigned top = get_band_bound(dest.height, i, band_count);
+	    unsigned bottom = get_band_bound(dest.height, i + 1, band_count);
+	    tasks.push_back(
+		boost::bind(video_effect_fade,
+			    raw_frame_ref_band(dest, top, bottom),
+			    raw_frame_ref_band(sec, top, bottom),
+			    scale_));
+	}
+	mixer.workers_.run(tasks);
     }
     return retval;
 }
 
+std::tr1::shared_ptr<mixer::video_mix>
+mixer::video_mix_fade::get_successor() const
+{
+    if (finished_)
+	return std::tr1::shared_ptr<video_mix>(
+	    new video_mix_simple(sec_source_id_));
+    return std::tr1::shared_ptr<video_mix>();
+}
+
 std::tr1::shared_ptr<mixer::video_mix> mixer::create_video_mix_simple(source_id id)
 {
     return std::tr1::shared_ptr<mixer::video_mix>(new video_mix_simple(id));
@@ -832,52 +1359,148 @@ mixer::create_video_mix_fade(source_id pri_source_id,
         new video_mix_fade(pri_source_id, sec_source_id, timed, ms, scale));
 }
 
-void mixer::run_mixer()
+mixer::stage_queue::stage_queue(std::size_t capacity)
+    : items_(capacity),
+      next_serial_num_(0),
+      stopped_(false)
+{}
+
+bool mixer::stage_queue::push_swap(mix_result & item)
 {
-    dv_frame_ptr last_mixed_dv;
-    unsigned serial_num = 0;
-    const mix_data * m = 0;
+    {
+	boost::mutex::scoped_lock lock(mutex_);
+	while (!stopped_ && items_.full())
+	    cond_.wait(lock);
+	if (stopped_)
+	    return false;
+	items_.push_swap(item);
+    }
+    cond_.notify_all();
+    return true;
+}
 
-    auto_codec decoder(auto_codec_open_decoder(AV_CODEC_ID_DVVIDEO));
-    AVCodecContext * dec = decoder.get();
-    dec->get_buffer = raw_frame_get_buffer;
-    dec->release_buffer = raw_frame_release_buffer;
-    dec->reget_buffer = raw_frame_reget_buffer;
+bool mixer::stage_queue::push_swap_in_order(mix_result & item)
+{
+    {
+	boost::mutex::scoped_lock lock(mutex_);
+	while (!stopped_
+	       && (item.serial_num != next_serial_num_ || items_.full()))
+	    cond_.wait(lock);
+	if (stopped_)
+	    return false;
+	items_.push_swap(item);
+	++next_serial_num_;
+    }
+    cond_.notify_all();
+    return true;
+}
 
-    auto_codec encoder(avcodec_alloc_context3(NULL));
-    AVCodecContext * enc = NULL;
+bool mixer::stage_queue::pop_swap(mix_result & item)
+{
+    {
+	boost::mutex::scoped_lock lock(mutex_);
+	while (!stopped_ && items_.empty())
+	    cond_.wait(lock);
+	if (stopped_)
+	    return false;
+	items_.pop_swap(item);
+    }
+    cond_.notify_all();
+    return true;
+}
 
-    for (;;)
+void mixer::stage_queue::stop()
+{
     {
-	// Get the next set of source frames and mix settings (or stop
-	// if requested)
-	{
-	    boost::mutex::scoped_lock lock(mixer_mutex_);
+	boost::mutex::scoped_lock lock(mutex_);
+	stopped_ = true;
+    }
+    cond_.notify_all();
+}
 
-	    if (m)
-		mixer_queue_.pop();
+// The output pipeline has three stages: mixing (including decoding),
+// encoding, and output.  Mixing and output each run in a single
+// thread and handle frames in order.  Encoding runs in several
+// threads which take consecutive frames, and they put the frames
+// back in order as they pass them on.  So the pipeline does not
+// reorder frames, but can work on several at once.
 
-	    while (mixer_state_ != run_state_stop && mixer_queue_.empty())
-		mixer_state_cond_.wait(lock);
-	    if (mixer_state_ == run_state_stop)
-		break;
+void mixer::run_mixer()
+{
+    unsigned serial_num = 0;
+    mix_data data;
+    const mix_data * m = &data;
+    mix_result result;
 
-	    m = &mixer_queue_.front();
+    for (;;)
+    {
+	// Get the next set of source frames and mix settings (or stop
+	// if requested).  Our previous data is swapped into the
+	// queue, so release the frames it refers to first.
+	data.clear();
+	if (!mixer_queue_.pop_swap(data))
+	{
+	    {
+		boost::mutex::scoped_lock lock(mixer_mutex_);
+		if (mixer_stopped_)
+		    break;
+	    }
+	    mixer_queue_event_.wait();
+	    continue;
 	}
 
 	for (unsigned id = 0; id != m->source_frames.size(); ++id)
 	    if (m->source_frames[id])
 		m->source_frames[id]->serial_num = serial_num;
+	m->source_raw_frames.resize(m->source_frames.size());
 
-	dv_frame_ptr mixed_dv;
-	raw_frame_ptr mixed_raw;
+	result.clear();
+	result.serial_num = serial_num;
 
-	if (m->settings.video_mix->apply(*m, decoder, mixed_raw, mixed_dv))
+	if (m->settings.video_mix->apply(*this, *m, result))
 	    m->settings.video_mix->status(monitor_);
 
+	// If the mix was a transition that has now finished, replace
+	// it with its successor - unless it has been replaced already
+	std::tr1::shared_ptr<video_mix> successor =
+	    m->settings.video_mix->get_successor();
+	if (successor)
+	{
+	    boost::mutex::scoped_lock lock(source_mutex_);
+	    if (settings_.video_mix == m->settings.video_mix)
+	    {
+		settings_.video_mix->set_active(*this, false);
+		settings_.video_mix = successor;
+		settings_.video_mix->set_active(*this, true);
+	    }
+	}
+
+	result.data.swap(data);
+	++serial_num;
+
+	if (!encoder_queue_.push_swap(result))
+	    break;
+    }
+}
+
+void mixer::run_encoder()
+{
+    auto_codec encoder(avcodec_alloc_context3(NULL));
+    AVCodecContext * enc = NULL;
+    mix_result result;
+
+    for (;;)
+    {
+	result.clear();
+	if (!encoder_queue_.pop_swap(result))
+	    break;
+
+	const raw_frame_ptr & mixed_raw = result.mixed_raw;
+
 	if (mixed_raw)
 	{
 	    // Encode mixed video
+	    const mix_data * m = &result.data;
 	    const dv_system * system = m->format.system;
 	    if (!enc) {
 		enc = encoder.get();
@@ -887,11 +1510,9 @@ void mixer::run_mixer()
 		enc->height = system->frame_height;
 		enc->pix_fmt = mixed_raw->pix_fmt;
 
-		// Try to use one thread per CPU, up to a limit of 8
-		int enc_thread_count =
-		    std::min<int>(8, std::max<long>(sysconf(_SC_NPROCESSORS_ONLN), 1));
-		std::cout << "INFO: DV encoder threads: " << enc_thread_count << "\n";
-		auto_codec_open_encoder(encoder, AV_CODEC_ID_DVVIDEO, enc_thread_count);
+		// Other encoder threads work on other frames, so
+		// this context uses no threads of its own
+		auto_codec_open_encoder(encoder, AV_CODEC_ID_DVVIDEO);
 	    }
 	    enc->sample_aspect_ratio.num = system->pixel_aspect[m->format.frame_aspect].width;
 	    enc->sample_aspect_ratio.den = system->pixel_aspect[m->format.frame_aspect].height;
@@ -900,16 +1521,33 @@ void mixer::run_mixer()
 	    enc->sample_aspect_ratio.den *= 41;
 	    enc->time_base.num = system->frame_rate_denom;
 	    enc->time_base.den = system->frame_rate_numer;
-	    mixed_raw->header.pts = serial_num;
-  	    mixed_dv = allocate_dv_frame();
+	    mixed_raw->header.pts = result.serial_num;
+	    dv_frame_ptr mixed_dv = allocate_dv_frame();
+	    // Give the encoder the frame buffer as its output buffer,
+	    // so that it doesn't allocate a packet for every frame.
+	    // Some versions of libavcodec may still return their own
+	    // buffer, in which case we must copy from it.
 	    AVPacket packet;
 	    memset(&packet, 0, sizeof(AVPacket));
+	    packet.data = mixed_dv->buffer;
+	    packet.size = sizeof(mixed_dv->buffer);
 	    int got_packet;
-	    int out_size = avcodec_encode_video2(enc,
-						&packet,
-						&mixed_raw->header, &got_packet);
-	    assert(size_t(out_size) == system->size);
-	    mixed_dv->serial_num = serial_num;
+	    int ret = avcodec_encode_video2(enc,
+					    &packet,
+					    &mixed_raw->header, &got_packet);
+	    assert(ret == 0 && got_packet
+		   && size_t(packet.size) == system->size);
+	    if (packet.data != mixed_dv->buffer)
+		std::memcpy(mixed_dv->buffer, packet.data, system->size);
+	    av_free_packet(&packet);
+	    mixed_dv->serial_num = result.serial_num;
+
+	    // Keep the unchanged video segments of the base frame, to
+	    // avoid generation loss
+	    if (result.base_dv)
+		dv_buffer_copy_video_outside(mixed_dv->buffer,
+					     result.base_dv->buffer,
+					     &result.changed_region);
 
 	    // libavcodec doesn't properly distinguish IEC and SMPTE
 	    // variants of NTSC.  Fix the APTs here.
@@ -920,43 +1558,261 @@ void mixer::run_mixer()
 		for (unsigned i = 4; i != 8; ++i)
 		    block[i] = (block[i] & 0xf8) | apt;
 	    }
+
+	    result.mixed_dv = mixed_dv;
+	}
+
+	if (!output_queue_.push_swap_in_order(result))
+	    break;
+    }
+}
+
+mixer::audio_bus_state::audio_bus_state()
+    : sample_rate(dv_sample_rate_auto),
+      system(0)
+{
+}
+
+void mixer::put_source_audio(audio_bus_state & bus,
+			     audio_bus_channel & channel,
+			     const dv_frame_ptr & source_dv, bool keep_frame)
+{
+    if (!source_dv
+	|| dv_frame_get_sample_rate(source_dv.get()) != bus.sample_rate)
+	return;
+
+    unsigned frame_count = dv_buffer_get_audio(source_dv->buffer, bus.samples);
+    unsigned serial = channel.resampler.put(bus.samples, frame_count);
+    unsigned index = serial % audio_resampler::max_tracked_puts;
+    channel.put_serials[index] = serial;
+    if (keep_frame && dv_frame_system(source_dv.get()) == bus.system)
+	channel.put_frames[index] = source_dv;
+    else
+	channel.put_frames[index].reset();
+}
+
+// Each input goes through its own resampler, so that its clock drift
+// and any missing frames don't cause clicks.
+void mixer::mix_audio(const mix_data & m, unsigned serial_num,
+		      dv_frame & mixed_dv, audio_bus_state & bus)
+{
+    const dv_sample_rate sample_rate = m.format.sample_rate;
+    const dv_system * system = dv_frame_system(&mixed_dv);
+    const unsigned channel_count = max_audio_bus_inputs + 1;
+
+    // Restart all channels if the format changes
+    if (sample_rate != bus.sample_rate || system != bus.system)
+    {
+	bus.sample_rate = sample_rate;
+	bus.system = system;
+	for (unsigned c = 0; c != channel_count; ++c)
+	    bus.channels[c].id = invalid_id;
+    }
+
+    // List the inputs with non-zero gain
+    audio_bus_input inputs[max_audio_bus_inputs + 1];
+    unsigned input_count = 0;
+    bool audio_source_listed = false;
+    for (unsigned i = 0; i != m.settings.audio_bus_count; ++i)
+    {
+	const audio_bus_input & input = m.settings.audio_bus[i];
+	if (input.id == m.settings.audio_source_id)
+	    audio_source_listed = true;
+	if (input.gain != 0 && input.id < m.source_frames.size())
+	    inputs[input_count++] = input;
+    }
+    if (!audio_source_listed
+	&& m.settings.audio_source_id < m.source_frames.size())
+    {
+	inputs[input_count].id = m.settings.audio_source_id;
+	inputs[input_count].gain = PCM_GAIN_UNITY;
+	++input_count;
+    }
+
+    // Keep the channels of continuing inputs and assign free channels
+    // to new ones
+    audio_bus_channel * input_channels[max_audio_bus_inputs + 1] = {};
+    for (unsigned c = 0; c != channel_count; ++c)
+    {
+	audio_bus_channel & channel = bus.channels[c];
+	channel.used = false;
+	for (unsigned i = 0; i != input_count; ++i)
+	{
+	    if (inputs[i].id == channel.id)
+	    {
+		channel.used = true;
+		input_channels[i] = &channel;
+	    }
 	}
+    }
+    for (unsigned i = 0; i != input_count; ++i)
+    {
+	if (input_channels[i])
+	    continue;
+	unsigned c = 0;
+	while (bus.channels[c].used)
+	    ++c;
+	assert(c != channel_count);
+	audio_bus_channel & channel = bus.channels[c];
+	channel.id = inputs[i].id;
+	channel.used = true;
+	// Buffer more than a whole frame, so that a missing or late
+	// source frame is covered without a gap
+	const unsigned max_frame_count =
+	    system->audio_frame_counts[sample_rate].max;
+	channel.resampler.reset(max_frame_count + max_frame_count / 2);
+	input_channels[i] = &channel;
+    }
+    for (unsigned c = 0; c != channel_count; ++c)
+    {
+	if (!bus.channels[c].used)
+	    for (unsigned j = 0; j != audio_resampler::max_tracked_puts; ++j)
+		bus.channels[c].put_frames[j].reset();
+    }
+
+    // A single input at unity gain has its source audio blocks
+    // passed through unchanged whenever the resampler reads out
+    // exactly the frames of one source frame.  This keeps the
+    // original samples, and all 4 channels of 12-bit audio.
+    const bool can_pass_through =
+	input_count == 1 && inputs[0].gain == PCM_GAIN_UNITY;
+    dv_frame_ptr pass_through_dv;
+
+    const unsigned frame_count =
+	system->audio_frame_counts[sample_rate].std_cycle[
+	    serial_num % system->audio_frame_counts[sample_rate].std_cycle_len];
+    const unsigned sample_count = PCM_CHANNELS * frame_count;
+    bool have_output = false;
+
+    for (unsigned i = 0; i != input_count; ++i)
+    {
+	audio_bus_channel & channel = *input_channels[i];
+
+	// Put the audio of any frames the clock thread skipped for
+	// this source, then of this tick's frame
+	for (std::size_t j = 0; j != m.skipped_frames.size(); ++j)
+	    if (m.skipped_frames[j].id == inputs[i].id)
+		put_source_audio(bus, channel, m.skipped_frames[j].frame,
+				 can_pass_through);
+	put_source_audio(bus, channel, m.source_frames[inputs[i].id],
+			 can_pass_through);
+
+	if (channel.resampler.get(bus.samples, frame_count,
+				  m.source_rates[inputs[i].id]))
+	{
+	    unsigned serial;
+	    if (can_pass_through
+		&& channel.resampler.get_passed_through(serial))
+	    {
+		unsigned index = serial % audio_resampler::max_tracked_puts;
+		if (channel.put_frames[index]
+		    && channel.put_serials[index] == serial)
+		{
+		    pass_through_dv = channel.put_frames[index];
+		    break;
+		}
+	    }
+
+	    if (have_output)
+		pcm_mix_add(bus.acc, bus.samples, sample_count, inputs[i].gain);
+	    else
+		pcm_mix_scale(bus.acc, bus.samples, sample_count,
+			      inputs[i].gain);
+	    have_output = true;
+	}
+    }
+
+    if (pass_through_dv)
+    {
+	dv_buffer_dub_audio(mixed_dv.buffer, pass_through_dv->buffer);
+	dv_get_audio_levels(bus.samples, frame_count, &mixed_dv.audio_levels);
+    }
+    else if (have_output)
+    {
+	pcm_mix_pack(bus.samples, bus.acc, sample_count);
+	dv_buffer_set_audio(mixed_dv.buffer, sample_rate, frame_count,
+			    bus.samples);
+	dv_get_audio_levels(bus.samples, frame_count, &mixed_dv.audio_levels);
+    }
+    else
+    {
+	dv_buffer_silence_audio(mixed_dv.buffer, sample_rate, serial_num);
+	for (unsigned channel = 0; channel != PCM_CHANNELS; ++channel)
+	{
+	    mixed_dv.audio_levels.rms[channel] = INT_MIN;
+	    mixed_dv.audio_levels.peak[channel] = INT_MIN;
+	}
+    }
+    mixed_dv.have_audio_levels = true;
+}
+
+namespace
+{
+    // Make a frame that has its own copy of the given frame's
+    // header, subcode, VAUX and audio blocks but shares its video
+    // blocks
+    dv_frame_ptr copy_frame_sharing_video(const dv_frame_ptr & frame)
+    {
+	dv_frame * video_frame = dv_frame_video(frame.get());
+	dv_frame_ptr result = allocate_dv_frame();
+	std::memcpy(result.get(), frame.get(), offsetof(dv_frame, buffer));
+	dv_buffer_copy_non_video(result->buffer, frame->buffer);
+	intrusive_ptr_add_ref(video_frame);
+	result->video_frame = video_frame;
+	return result;
+    }
+}
+
+void mixer::run_output()
+{
+    dv_frame_ptr last_mixed_dv;
+    mix_result result;
+    audio_bus_state audio_bus;
+
+    for (;;)
+    {
+	result.clear();
+	if (!output_queue_.pop_swap(result))
+	    break;
+
+	const mix_data * m = &result.data;
+	const unsigned serial_num = result.serial_num;
+	dv_frame_ptr & mixed_dv = result.mixed_dv;
 
 	if (!mixed_dv)
 	{
 	    std::cerr << "WARN: Repeating mixed frame\n"; // XXX not very informative
 
 	    // Make a copy of the last mixed frame so we can
-	    // replace the audio.  (We can't modify the last frame
-	    // because sinks may still be reading from it.)
-	    mixed_dv = allocate_dv_frame();
-	    std::memcpy(mixed_dv.get(),
-			last_mixed_dv.get(),
-			offsetof(dv_frame, buffer)
-			+ dv_frame_system(last_mixed_dv.get())->size);
+	    // replace the audio and subcode.  (We can't modify the
+	    // last frame because sinks may still be reading from
+	    // it.)  The video blocks are not copied but shared.
+	    mixed_dv = copy_frame_sharing_video(last_mixed_dv);
 	    mixed_dv->serial_num = serial_num;
 	}
-
-	const dv_frame_ptr & audio_source_dv =
-	    m->source_frames[m->settings.audio_source_id];
-
-	if (!audio_source_dv ||
-	    dv_frame_get_sample_rate(audio_source_dv.get()) != m->format.sample_rate)
+	else if (std::find(m->source_frames.begin(), m->source_frames.end(),
+			   mixed_dv)
+		 != m->source_frames.end())
 	{
-	    if (m->format.sample_rate >= 0)
-		dv_buffer_silence_audio(mixed_dv->buffer, m->format.sample_rate,
-					serial_num);
+	    // The video mix passed a source frame through.  That is
+	    // shared with the monitor's view of the source, so copy it
+	    // before replacing the audio, subcode and audio levels.
+	    mixed_dv = copy_frame_sharing_video(mixed_dv);
 	}
-	else if (mixed_dv != audio_source_dv)
-	    dv_buffer_dub_audio(mixed_dv->buffer, audio_source_dv->buffer);
 
-	set_times(*mixed_dv);
+	const dv_sample_rate sample_rate = m->format.sample_rate;
+	if (sample_rate >= 0)
+	    mix_audio(*m, serial_num, *mixed_dv, audio_bus);
+	else
+	    mixed_dv->have_audio_levels = dv_buffer_get_audio_levels(
+		mixed_dv->buffer, &mixed_dv->audio_levels);
+
+	m->record_time.write(*mixed_dv);
 
 	mixed_dv->do_record = m->settings.do_record;
 	mixed_dv->cut_before = m->settings.cut_before;
 
 	last_mixed_dv = mixed_dv;
-	++serial_num;
 
 	// Sink the frame
 	{
@@ -964,9 +1820,13 @@ void mixer::run_mixer()
 	    for (sink_id id = 0; id != sinks_.size(); ++id)
 		if (sinks_[id])
 		    sinks_[id]->put_frame(mixed_dv);
+	    for (sink_id id = 0; id != sinks_.size(); ++id)
+		if (sinks_[id])
+		    sinks_[id]->end_frame();
 	}
 	if (monitor_)
 	    monitor_->put_frames(m->source_frames.size(), &m->source_frames[0],
-				 m->settings, mixed_dv, mixed_raw);
+				 &m->source_raw_frames[0],
+				 m->settings, mixed_dv, result.mixed_raw);
     }
 }
@@ -10,19 +10,26 @@
 #define DVSWITCH_MIXER_HPP
 
 #include <cstddef>
+#include <ctime>
+#include <deque>
 #include <vector>
 
 #include <tr1/memory>
 
+#include <boost/scoped_array.hpp>
 #include <boost/thread/condition.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/thread.hpp>
 
+#include "audio_resampler.hpp"
+#include "auto_codec.hpp"
 #include "auto_handle.hpp"
+#include "event_fd.hpp"
 #include "frame.h"
 #include "frame_pool.hpp"
 #include "geometry.h"
 #include "ring_buffer.hpp"
+#include "worker_pool.hpp"
 
 namespace boost
 {
@@ -44,10 +51,22 @@ public:
 	dv_sample_rate sample_rate;
     };
     struct video_mix;
+    // Maximum number of sources with explicit audio gains
+    static const unsigned max_audio_bus_inputs = 8;
+    struct audio_bus_input
+    {
+	source_id id;
+	unsigned gain;	// see pcm_mix.h
+    };
     struct mix_settings
     {
 	std::tr1::shared_ptr<mixer::video_mix> video_mix;
+	// The clock follows this source, and its audio is on the bus
+	// at unity gain unless audio_bus gives another gain for it
 	source_id audio_source_id;
+	// Other sources mixed into the output audio, with their gains
+	unsigned audio_bus_count;
+	audio_bus_input audio_bus[max_audio_bus_inputs];
 	bool do_record;
 	bool cut_before;
     };
@@ -65,19 +84,45 @@ public:
 	// Put a frame out.
 	// The frame is shared with other sinks and must not be
 	// modified.  It should be released as soon as possible.
+	// Its video blocks may be in another frame (see
+	// dv_frame::video_frame).
 	// This will be called at the appropriate frame rate even
 	// if there are no new frames available.  The serial_num
 	// member of the frame can be used to check whether the
 	// frame is new.
 	virtual void put_frame(const dv_frame_ptr &) = 0;
+	// Called after every sink has been given the frame, so that
+	// sinks sharing a consumer thread can wake it just once.
+	virtual void end_frame() {}
     };
 
     struct source_settings
     {
+	source_settings() : min_queue_len(1), max_queue_len(4) {}
 	std::string name;
 	std::string url;
 	bool use_video;
 	bool use_audio;
+	// Bounds on the number of frames buffered for the source.
+	// Within these, buffering adapts to the jitter in frame
+	// arrival times.
+	unsigned min_queue_len;
+	unsigned max_queue_len;
+    };
+
+    struct source_stats
+    {
+	// Current and target number of frames buffered
+	unsigned queue_len;
+	unsigned target_queue_len;
+	// Smoothed deviation of frame arrival intervals
+	unsigned jitter_us;
+	// Frame rate error relative to the nominal rate
+	int drift_ppm;
+	// Frames dropped because the queue was too long
+	unsigned long drops;
+	// Ticks where no frame was available
+	unsigned long repeats;
     };
 
     // Interface to sources
@@ -101,21 +146,33 @@ public:
 	// may be null if the sources are not producing frames.
 	// mix_settings is a copy of the settings used to select and
 	// mix these source frames.  mixed_dv is a pointer to the
-	// mixed frame that was sent to sinks.
+	// mixed frame that was sent to sinks.  If that repeats an
+	// earlier frame or passes a source frame through, its video
+	// blocks are in mixed_dv->video_frame.  The audio levels of
+	// source and mixed frames have already been measured and are
+	// in their audio_levels fields if have_audio_levels is set.
+	//
+	// source_raw points to an array, length source_count, of
+	// pointers to the raw video decoded from the source frames.
+	// A pointer is null if the mixer did not need to decode that
+	// source; the monitor should then decode it itself if it
+	// wants to display it.
 	//
 	// mixed_raw is a pointer to the raw video for the mixed
 	// frame, or null if the mixer did not need to decode video.
 	//
-	// All DV frames may be shared and must not be modified.  Raw
-	// frames may be modified by the monitor.  All references and
+	// All DV frames and source raw frames may be shared and must
+	// not be modified.  The mixed raw frame may be modified by the
+	// monitor.  All references and
 	// pointers passed to the function are invalid once it
 	// returns; it must copy shared_ptrs to ensure that frames
 	// remain valid.
 	//
-	// This is called in the context of the mixer thread and should
-	// return quickly.
+	// This is called in the context of the mixer's output thread
+	// and should return quickly.
 	virtual void put_frames(unsigned source_count,
 				const dv_frame_ptr * source_dv,
+				const raw_frame_ptr * source_raw,
 				mix_settings,
 				const dv_frame_ptr & mixed_dv,
 				const raw_frame_ptr & mixed_raw) = 0;
@@ -131,8 +188,13 @@ public:
     void remove_source(source_id);
     // Add a new frame from the given source.  This should be called at
     // appropriate intervals to avoid the need to drop or duplicate
-    // frames.
+    // frames.  Different sources may call this from different
+    // threads at the same time, and concurrently with add_source(),
+    // but each source must not call it concurrently with itself.
+    // It only holds the source lock long enough to find the source.
     void put_frame(source_id, const dv_frame_ptr &);
+    // Get buffering statistics for a source
+    source_stats get_source_stats(source_id);
 
     // Interface for sinks
     // Register and unregister sinks
@@ -164,6 +226,10 @@ public:
     void set_video_mix(std::tr1::shared_ptr<video_mix>);
     // Select the audio source for output
     void set_audio_source(source_id);
+    // Set the gain of a source's audio in the output.  A gain of 0
+    // removes it, except for the selected audio source which is
+    // then muted.
+    void set_audio_gain(source_id, unsigned gain);
     // Make a cut in the output as soon as possible, where appropriate
     // for the sink
     void cut();
@@ -171,55 +237,253 @@ public:
     void enable_record(bool);
 
 private:
+    // Gives tests access to the pipeline's data structures
+    friend struct mixer_test_access;
+
     class video_mix_pic_in_pic;
     class video_mix_simple;
     class video_mix_fade;
 
     // Source data.  We want to allow a bit of leeway in the input
     // pipeline before we have to drop or repeat a frame.  At the
-    // same time we don't want to add much to latency.  We try to
-    // keep the queue half-full so there are 2 frame-times
-    // (66-80 ms) of added latency here.
-    static const std::size_t target_queue_len = 2;
-    static const std::size_t full_queue_len = target_queue_len * 2;
+    // same time we don't want to add much to latency.  Each source
+    // has a target queue length which follows the jitter in its
+    // frame arrival times, so a steady local source may only need 1
+    // frame-time of added latency while a network source gets more.
+    // We try to keep each queue around its target length.
     struct source_data
     {
-	source_data() : frames(full_queue_len), src(NULL) {}
-	ring_buffer<dv_frame_ptr> frames;
+	source_data(source * src, const source_settings & settings);
+	// Written by put_frame() and read by the clock thread
+	spsc_ring_buffer<dv_frame_ptr> frames;
+	unsigned target_queue_len;
 	source * src;
+	unsigned min_queue_len;
+	unsigned max_queue_len;
+	// Used only by put_frame()
+	uint64_t last_timestamp;
+	unsigned jitter;	// ns
+	// Smoothed arrival interval (ns), or 0 if not yet known.
+	// Written by put_frame() and read by the clock thread.
+	unsigned arrival_interval;
+	unsigned shrink_count;
+	// Used only by the clock thread
+	bool started;
+	// Updated atomically
+	unsigned long drops;
+	unsigned long repeats;
+    };
+
+    // Timecode and record date/time for a mixed frame.  The date and
+    // time packs are only rebuilt when the second changes.
+    struct record_time_packs
+    {
+	record_time_packs() : time(-1) {}
+	void set_time(std::time_t);
+	void write(dv_frame &) const;
+
+	std::time_t time;
+	uint8_t video_date[DIF_PACK_SIZE];
+	uint8_t video_time[DIF_PACK_SIZE];
+	uint8_t audio_date[DIF_PACK_SIZE];
+	uint8_t audio_time[DIF_PACK_SIZE];
     };
 
     struct mix_data
     {
+
 	std::vector<dv_frame_ptr> source_frames;
 	format_settings format;
 	mix_settings settings;
+	// Set by the clock thread for the tick
+	record_time_packs record_time;
+	// Expected number of frames from each source per tick,
+	// based on their arrival times.  This is the same size as
+	// source_frames.
+	std::vector<double> source_rates;
+	// Frames that the clock thread skipped to catch up with a
+	// source, oldest first, so that their audio is not lost
+	struct skipped_frame
+	{
+	    source_id id;
+	    dv_frame_ptr frame;
+	};
+	std::vector<skipped_frame> skipped_frames;
+
+	// Cache of decoded source frames, so that each source frame
+	// is decoded at most once however many effects and monitors
+	// use it.  Each entry is tagged (through header.pts) with
+	// the serial_num of the DV frame it was decoded from.  The
+	// cached frames are shared and must not be modified.
+	// source_raw_frames must be the same size as source_frames.
+	mutable std::vector<raw_frame_ptr> source_raw_frames;
+	const raw_frame_ptr & decode_source(source_id,
+					    const auto_codec & decoder) const;
+
+	// mix_data objects are recycled between the clock and mixer
+	// threads and along the output pipeline, so that their
+	// storage is reused.  These functions do not allocate.
+	// Release the frames, but keep the storage for reuse
+	void clear();
+	void swap(mix_data &);
+	// This is found by argument-dependent lookup, so that
+	// spsc_ring_buffer and std algorithms don't copy
+	friend void swap(mix_data & left, mix_data & right)
+	{
+	    left.swap(right);
+	}
     };
 
+    // Mixed frame being passed along the output pipeline.  The mixer
+    // thread produces the raw frame (or selects a source DV frame),
+    // an encoder thread produces the DV frame and the output thread
+    // adds audio and timecode and passes it to sinks and the monitor.
+    struct mix_result
+    {
+	mix_data data;
+	unsigned serial_num;
+	raw_frame_ptr mixed_raw;
+	dv_frame_ptr mixed_dv;
+	// If base_dv is set, mixed_raw differs from the decoded
+	// base_dv only within changed_region.  The encoder keeps the
+	// video segments of base_dv that lie wholly outside it.
+	dv_frame_ptr base_dv;
+	rectangle changed_region;
+
+	// Release the frames, but keep the storage for reuse
+	void clear();
+	void swap(mix_result &);
+	friend void swap(mix_result & left, mix_result & right)
+	{
+	    left.swap(right);
+	}
+    };
+
+    // Bounded queue between two stages of the output pipeline.
+    // Items are swapped in and out, as for spsc_ring_buffer.
+    class stage_queue
+    {
+    public:
+	explicit stage_queue(std::size_t capacity);
+	// Add an item, waiting for space if the queue is full.
+	// Return false if the queue has been stopped.
+	bool push_swap(mix_result &);
+	// Add an item after the item with the previous serial number,
+	// waiting for that and for space.  This puts back in order
+	// the items from several producers.  Return false if the queue
+	// has been stopped.
+	bool push_swap_in_order(mix_result &);
+	// Remove the next item, waiting for one if the queue is
+	// empty.  Return false if the queue has been stopped.
+	bool pop_swap(mix_result &);
+	// Stop the queue, waking up any waiting thread
+	void stop();
+
+    private:
+	boost::mutex mutex_; // controls access to the following
+	spsc_ring_buffer<mix_result> items_;
+	unsigned next_serial_num_; // for push_swap_in_order()
+	bool stopped_;
+	boost::condition cond_;
+    };
+
+    // Capacity of each stage queue.  Each stage can get this many
+    // frames ahead of the next before it has to wait.
+    static const std::size_t stage_queue_len = 2;
+
     enum run_state {
 	run_state_wait,
 	run_state_run,
 	run_state_stop
     };
 
+    // Check a source frame against the current format settings,
+    // and auto-select the format if necessary.  Called in the clock
+    // thread with source_mutex_ locked.
+    void check_source_format(source_id, dv_frame &);
+
     void run_clock();   // clock thread function
     void run_mixer();   // mixer thread function
+    void run_encoder(); // encoder threads function
+    void run_output();  // output thread function
+
+    // Output thread's state for mixing audio
+    struct audio_bus_channel
+    {
+	audio_bus_channel() : id(invalid_id), used(false) {}
+	source_id id;
+	bool used;
+	audio_resampler resampler;
+	// Source frames whose audio was put into the resampler,
+	// indexed by put serial number modulo max_tracked_puts, so
+	// that their audio blocks can be passed through
+	dv_frame_ptr put_frames[audio_resampler::max_tracked_puts];
+	unsigned put_serials[audio_resampler::max_tracked_puts];
+    };
+    struct audio_bus_state
+    {
+	audio_bus_state();
+	dv_sample_rate sample_rate;
+	const dv_system * system;
+	audio_bus_channel channels[max_audio_bus_inputs + 1];
+	pcm_sample samples[PCM_CHANNELS * PCM_PACKET_SIZE_MAX];
+	int32_t acc[PCM_CHANNELS * PCM_PACKET_SIZE_MAX];
+    };
+    // Mix audio from the bus inputs into a mixed frame.  Called in
+    // the output thread.
+    static void mix_audio(const mix_data &, unsigned serial_num,
+			  dv_frame & mixed_dv, audio_bus_state &);
+    // Put the audio of a source frame into a bus channel.  If
+    // keep_frame is true, keep a reference to the frame so that
+    // its audio can be passed through.
+    static void put_source_audio(audio_bus_state &, audio_bus_channel &,
+				 const dv_frame_ptr &, bool keep_frame);
+
+    // Decode the given sources in parallel, adding them to the cache
+    // in m.  Called in the mixer thread.
+    void decode_sources(const mix_data & m,
+			const source_id * ids, std::size_t count);
+    static void decode_source_task(const mix_data *, source_id,
+				   const auto_codec * decoders,
+				   unsigned worker);
+    static void decode_frame_task(const dv_frame_ptr *, raw_frame_ptr *,
+				  const auto_codec * decoders,
+				  unsigned worker);
+    // Get the decoders for each worker at the given reduction in
+    // resolution (as a power of 2)
+    const auto_codec * get_decoders(unsigned lowres) const;
 
     mutable boost::mutex source_mutex_; // controls access to the following
     format_settings format_;
     mix_settings settings_;
-    std::vector<source_data> sources_;
+    // A deque, so that adding a source doesn't move the others and
+    // put_frame() can use its source without holding the lock
+    std::deque<source_data> sources_;
     run_state clock_state_;
     boost::condition clock_state_cond_;
 
+    // Only used by put_frame(), to note that it has started the clock.
+    // Updated atomically.
+    bool clock_started_;
+
     boost::thread clock_thread_;
 
+    // Written by the clock thread and read by the mixer thread
+    spsc_ring_buffer<mix_data> mixer_queue_;
+    event_fd mixer_queue_event_; // signalled for each push or stop
     boost::mutex mixer_mutex_; // controls access to the following
-    ring_buffer<mix_data> mixer_queue_;
-    run_state mixer_state_;
-    boost::condition mixer_state_cond_;
+    bool mixer_stopped_;
+
+    // Workers used by the mixer thread for decoding and effects, and
+    // decoder contexts for each of them at each supported resolution
+    worker_pool workers_;
+    boost::scoped_array<auto_codec> decoders_;
+
+    stage_queue encoder_queue_, output_queue_;
 
     boost::thread mixer_thread_;
+    boost::thread_group encoder_threads_;
+    boost::thread output_thread_;
 
     boost::mutex sink_mutex_; // controls access to the following
     std::vector<sink *> sinks_;
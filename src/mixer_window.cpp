@@ -4,6 +4,7 @@
 // The top-level window
 
 #include <cerrno>
+#include <cstdio>
 #include <cstring>
 #include <iostream>
 #include <stdexcept>
@@ -26,6 +27,7 @@
 #include "gui.hpp"
 #include "mixer.hpp"
 #include "mixer_window.hpp"
+#include "pcm_mix.h"
 #include "sources_dialog.hpp"
 
 // Window layout:
@@ -333,6 +335,8 @@ void mixer_window::init_osc_connection(OSC * osc)
 	sigc::mem_fun(selector_, &dv_selector_widget::select_sec));
     osc_->signal_audio_selected().connect(
 	sigc::mem_fun(selector_, &dv_selector_widget::select_snd));
+    osc_->signal_audio_gain_set().connect(
+	sigc::mem_fun(*this, &mixer_window::set_audio_gain));
 
     osc_->signal_mfade_set().connect(
 	sigc::mem_fun(*this, &mixer_window::mfade_set));
@@ -349,6 +353,23 @@ void mixer_window::init_osc_connection(OSC * osc)
 	sigc::mem_fun(*this, &mixer_window::quit));
 }
 
+void mixer_window::set_audio_gain(mixer::source_id id, float gain)
+{
+    int fixed_gain = gain * PCM_GAIN_UNITY + 0.5f;
+    if (fixed_gain < 0)
+	fixed_gain = 0;
+    else if (fixed_gain > PCM_GAIN_MAX)
+	fixed_gain = PCM_GAIN_MAX;
+    try
+    {
+	mixer_.set_audio_gain(id, fixed_gain);
+    }
+    catch (std::exception & e)
+    {
+	std::cerr << "WARN: " << e.what() << "\n";
+    }
+}
+
 void mixer_window::rec_start()
 {
     if (!mixer_.can_record()) return;
@@ -668,8 +689,40 @@ void mixer_window::mfade_update()
     }
 }
 
+bool mixer_window::update_source_stats() throw()
+{
+    // Show each source's buffering and timing in its thumbnail's
+    // tooltip
+    for (mixer::source_id id = 0; id != source_count_; ++id)
+    {
+	try
+	{
+	    mixer::source_stats stats = mixer_.get_source_stats(id);
+	    char text[200];
+	    snprintf(text, sizeof(text),
+		     gettext("Buffered: %u of %u frames\n"
+			     "Jitter: %u \xc2\xb5s\n"
+			     "Drift: %+d ppm\n"
+			     "Dropped: %lu frames\n"
+			     "Repeated: %lu frames"),
+		     stats.queue_len, stats.target_queue_len,
+		     stats.jitter_us, stats.drift_ppm,
+		     stats.drops, stats.repeats);
+	    selector_.set_source_tooltip(id, text);
+	}
+	catch (std::exception & e)
+	{
+	    std::cerr << "ERROR: Failed to update source status: "
+		      << e.what() << "\n";
+	}
+    }
+
+    return true; // call again
+}
+
 void mixer_window::put_frames(unsigned source_count,
 			      const dv_frame_ptr * source_dv,
+			      const raw_frame_ptr * source_raw,
 			      mixer::mix_settings mix_settings,
 			      const dv_frame_ptr & mixed_dv,
 			      const raw_frame_ptr & mixed_raw)
@@ -677,6 +730,7 @@ void mixer_window::put_frames(unsigned source_count,
     {
 	boost::mutex::scoped_lock lock(frame_mutex_);
 	source_dv_.assign(source_dv, source_dv + source_count);
+	source_raw_.assign(source_raw, source_raw + source_count);
 	mix_settings_ = mix_settings;
 	mixed_dv_ = mixed_dv;
 	mixed_raw_ = mixed_raw;
@@ -698,6 +752,7 @@ bool mixer_window::update(Glib::IOCondition) throw()
     {
 	dv_frame_ptr mixed_dv;
 	std::vector<dv_frame_ptr> source_dv;
+	std::vector<raw_frame_ptr> source_raw;
 	raw_frame_ptr mixed_raw;
 
 	{
@@ -706,6 +761,8 @@ bool mixer_window::update(Glib::IOCondition) throw()
 	    mixed_dv_.reset();
 	    source_dv = source_dv_;
 	    source_dv_.clear();
+	    source_raw = source_raw_;
+	    source_raw_.clear();
 	    mixed_raw = mixed_raw_;
 	    mixed_raw_.reset();
 	}
@@ -718,13 +775,9 @@ bool mixer_window::update(Glib::IOCondition) throw()
 	if (mixed_raw)
 	    display_.put_frame(mixed_raw);
 	else if (mixed_dv)
-	    display_.put_frame(mixed_dv);
-	if (mixed_dv)
-	{
-	    int levels[2];
-	    dv_buffer_get_audio_levels(mixed_dv->buffer, levels);
-	    vu_meter_.set_levels(levels);
-	}
+	    display_.put_frame(dv_frame_ptr(dv_frame_video(mixed_dv.get())));
+	if (mixed_dv && mixed_dv->have_audio_levels)
+	    vu_meter_.set_levels(mixed_dv->audio_levels.rms);
 
 	std::size_t count = source_dv.size();
 	selector_.set_source_count(count);
@@ -750,7 +803,15 @@ bool mixer_window::update(Glib::IOCondition) throw()
 
 	    if (source_dv[id])
 	    {
-		selector_.put_frame(id, source_dv[id]);
+		// Use the mixer's decoded frame if there is one
+		if (source_raw[id])
+		    selector_.put_frame(id, source_raw[id],
+					source_dv[id]->format_error);
+		else
+		    selector_.put_frame(id, source_dv[id]);
+		if (source_dv[id]->have_audio_levels)
+		    selector_.set_audio_levels(id,
+					       source_dv[id]->audio_levels.rms);
 
 		boost::mutex::scoped_lock lock(frame_mutex_);
 		if (mixed_dv_)
@@ -64,9 +64,11 @@ private:
 
     void toggle_record() throw();
     bool update(Glib::IOCondition) throw();
+    bool update_source_stats() throw();
 
     void set_pri_video_source(mixer::source_id);
     void set_sec_video_source(mixer::source_id);
+    void set_audio_gain(mixer::source_id, float);
 
     void mfade_mix();
     void mfade_update();
@@ -75,6 +77,7 @@ private:
 
     virtual void put_frames(unsigned source_count,
 			    const dv_frame_ptr * source_dv,
+			    const raw_frame_ptr * source_raw,
 			    mixer::mix_settings,
 			    const dv_frame_ptr & mixed_dv,
 			    const raw_frame_ptr & mixed_raw);
@@ -144,6 +147,7 @@ private:
 
     boost::mutex frame_mutex_; // controls access to the following
     std::vector<dv_frame_ptr> source_dv_;
+    std::vector<raw_frame_ptr> source_raw_;
     mixer::source_id next_source_id_;
     mixer::mix_settings mix_settings_;
     dv_frame_ptr mixed_dv_;
@@ -39,6 +39,13 @@ void OSC::oscb_snd (lo_arg ** argv, int argc)
     audio_selected_signal_(argv[0]->i);
 }
 
+void OSC::oscb_gain (lo_arg ** argv, int argc)
+{
+    if (want_verbose_)
+	fprintf(stderr, "OSC 'snd/gain' %d %d %f\n", argc, argv[0]->i, argv[1]->f);
+    audio_gain_set_signal_(argv[0]->i, argv[1]->f);
+}
+
 void OSC::oscb_start (lo_arg **, int argc)
 {
     if (want_verbose_)
@@ -125,6 +132,7 @@ int OSC::initialize_osc(int osc_port)
     OSC_REGISTER_CALLBACK(oscst_, "/dvswitch/src/pri", "i", oscb_pri);
     OSC_REGISTER_CALLBACK(oscst_, "/dvswitch/src/sec", "i", oscb_sec);
     OSC_REGISTER_CALLBACK(oscst_, "/dvswitch/src/snd", "i",  oscb_snd);
+    OSC_REGISTER_CALLBACK(oscst_, "/dvswitch/snd/gain", "if", oscb_gain);
 
     OSC_REGISTER_CALLBACK(oscst_, "/dvswitch/fx/overlay", "i",   oscb_overlay);
     OSC_REGISTER_CALLBACK(oscst_, "/dvswitch/fx/fade",    "i",   oscb_fade);
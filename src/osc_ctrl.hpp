@@ -25,6 +25,7 @@ class OSC
 	sigc::signal1<void, mixer::source_id> & signal_pri_video_selected() { return pri_video_selected_signal_;}
 	sigc::signal1<void, mixer::source_id> & signal_sec_video_selected() { return sec_video_selected_signal_;}
 	sigc::signal1<void, mixer::source_id> & signal_audio_selected()     { return audio_selected_signal_;}
+	sigc::signal2<void, mixer::source_id, float> & signal_audio_gain_set() { return audio_gain_set_signal_;}
 	sigc::signal1<void, int> & signal_tfade_set()    { return tfade_set;}
 	sigc::signal1<void, int> & signal_mfade_set() { return mfade_set;}
 	sigc::signal<void> & signal_cut_recording()   { return cut_recording_signal_;}
@@ -43,6 +44,7 @@ class OSC
 	sigc::signal1<void, mixer::source_id> pri_video_selected_signal_;
 	sigc::signal1<void, mixer::source_id> sec_video_selected_signal_;
 	sigc::signal1<void, mixer::source_id> audio_selected_signal_;
+	sigc::signal2<void, mixer::source_id, float> audio_gain_set_signal_;
 	sigc::signal1<void, int> tfade_set;
 	sigc::signal1<void, int> mfade_set;
 	sigc::signal<void> cut_recording_signal_;
@@ -62,6 +64,7 @@ class OSC
 	OSC_PATH_CALLBACK(oscb_pri)
 	OSC_PATH_CALLBACK(oscb_sec)
 	OSC_PATH_CALLBACK(oscb_snd)
+	OSC_PATH_CALLBACK(oscb_gain)
 
 	OSC_PATH_CALLBACK(oscb_overlay)
 	OSC_PATH_CALLBACK(oscb_fade)
@@ -0,0 +1,95 @@
+// See the file "COPYING" for licence details.
+
+// Gain and summing kernels for mixing PCM audio
+
+#include <assert.h>
+#include <stdbool.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "pcm_mix.h"
+
+// Each function has an SSE2 loop handling 8 samples at a time, with
+// the scalar loop finishing off the remainder (or doing everything
+// where SSE2 is not available).
+
+#ifdef __SSE2__
+// Multiply 8 samples by gain, giving two vectors of 4 scaled 32-bit
+// products
+static inline void pcm_mix_mul_8(const pcm_sample * samples, __m128i gain,
+				 __m128i * lo, __m128i * hi)
+{
+    __m128i s = _mm_loadu_si128((const __m128i *)samples);
+    __m128i prod_lo = _mm_mullo_epi16(s, gain);
+    __m128i prod_hi = _mm_mulhi_epi16(s, gain);
+    *lo = _mm_srai_epi32(_mm_unpacklo_epi16(prod_lo, prod_hi),
+			 PCM_GAIN_SHIFT);
+    *hi = _mm_srai_epi32(_mm_unpackhi_epi16(prod_lo, prod_hi),
+			 PCM_GAIN_SHIFT);
+}
+#endif
+
+static void pcm_mix_gain(int32_t * acc, const pcm_sample * samples,
+			 size_t count, unsigned gain, bool add)
+{
+    assert(gain <= PCM_GAIN_MAX);
+    size_t i = 0;
+
+#ifdef __SSE2__
+    __m128i gain_v = _mm_set1_epi16((int16_t)gain);
+    for (; i + 8 <= count; i += 8)
+    {
+	__m128i lo, hi;
+	pcm_mix_mul_8(samples + i, gain_v, &lo, &hi);
+	if (add)
+	{
+	    lo = _mm_add_epi32(lo, _mm_loadu_si128((__m128i *)(acc + i)));
+	    hi = _mm_add_epi32(hi, _mm_loadu_si128((__m128i *)(acc + i + 4)));
+	}
+	_mm_storeu_si128((__m128i *)(acc + i), lo);
+	_mm_storeu_si128((__m128i *)(acc + i + 4), hi);
+    }
+#endif
+
+    for (; i != count; ++i)
+    {
+	int32_t value = ((int32_t)samples[i] * (int32_t)gain) >> PCM_GAIN_SHIFT;
+	acc[i] = add ? acc[i] + value : value;
+    }
+}
+
+void pcm_mix_scale(int32_t * acc, const pcm_sample * samples, size_t count,
+		   unsigned gain)
+{
+    pcm_mix_gain(acc, samples, count, gain, false);
+}
+
+void pcm_mix_add(int32_t * acc, const pcm_sample * samples, size_t count,
+		 unsigned gain)
+{
+    pcm_mix_gain(acc, samples, count, gain, true);
+}
+
+void pcm_mix_pack(pcm_sample * samples, const int32_t * acc, size_t count)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + 8 <= count; i += 8)
+    {
+	__m128i lo = _mm_loadu_si128((const __m128i *)(acc + i));
+	__m128i hi = _mm_loadu_si128((const __m128i *)(acc + i + 4));
+	_mm_storeu_si128((__m128i *)(samples + i), _mm_packs_epi32(lo, hi));
+    }
+#endif
+
+    for (; i != count; ++i)
+    {
+	int32_t value = acc[i];
+	samples[i] = value < INT16_MIN ? INT16_MIN
+	    : value > INT16_MAX ? INT16_MAX
+	    : value;
+    }
+}
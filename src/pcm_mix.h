@@ -0,0 +1,43 @@
+// See the file "COPYING" for licence details.
+
+// Gain and summing kernels for mixing PCM audio
+
+#ifndef DVSWITCH_PCM_MIX_H
+#define DVSWITCH_PCM_MIX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pcm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Gains are fixed-point with PCM_GAIN_SHIFT fractional bits, so
+// PCM_GAIN_UNITY leaves samples unchanged and the maximum gain is
+// just under 4 (+12 dB).
+#define PCM_GAIN_SHIFT	13
+#define PCM_GAIN_UNITY	(1 << PCM_GAIN_SHIFT)
+#define PCM_GAIN_MAX	0x7fff
+
+// Mixing is done in an accumulator of 32-bit samples.  Each function
+// processes count samples (not frames).
+
+// Set accumulator to samples multiplied by gain
+void pcm_mix_scale(int32_t * acc, const pcm_sample * samples, size_t count,
+		   unsigned gain);
+
+// Add samples multiplied by gain to accumulator
+void pcm_mix_add(int32_t * acc, const pcm_sample * samples, size_t count,
+		 unsigned gain);
+
+// Convert accumulator to samples, saturating
+void pcm_mix_pack(pcm_sample * samples, const int32_t * acc, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !defined(DVSWITCH_PCM_MIX_H)
@@ -1,7 +1,7 @@
 // Copyright 2007, 2011 Ben Hutchings.
 // See the file "COPYING" for licence details.
 
-// Class template for ring buffers
+// Class templates for ring buffers
 
 #ifndef DVSWITCH_RING_BUFFER_HPP
 #define DVSWITCH_RING_BUFFER_HPP
@@ -134,4 +134,179 @@ void swap(ring_buffer<T> & left, ring_buffer<T> & right)
     swap(left.buffer_, right.buffer_);
 }
 
+// Ring buffer that can be used by one reader thread and one writer
+// thread at the same time without locking.  The capacity is rounded
+// up to a power of 2.  Values are moved in and out by swapping
+// where possible, so T should have a cheap default constructor and
+// an efficient swap() that is found by argument-dependent lookup.
+// Otherwise std::swap() is used, which makes three copies.  Each
+// slot holds a default-constructed value
+// until it is first used, and after that it holds whatever value
+// the reader left in it.
+
+template<typename T>
+class spsc_ring_buffer
+{
+public:
+    explicit spsc_ring_buffer(std::size_t capacity);
+    // Copying is not thread-safe; neither buffer may be in use
+    spsc_ring_buffer(const spsc_ring_buffer &);
+    ~spsc_ring_buffer();
+    spsc_ring_buffer & operator=(const spsc_ring_buffer &);
+
+    std::size_t capacity() const { return mask_ + 1; }
+    // These may be called from either thread, but the result may
+    // be out of date by the time it is returned
+    std::size_t size() const;
+    bool empty() const { return size() == 0; }
+    bool full() const { return size() == capacity(); }
+
+    // Reader functions.  These return false, or 0, if the buffer
+    // is empty.
+    // Reset the front value to a default-constructed value, and
+    // then pop it
+    bool pop();
+    // Swap the front value with value, and then pop it
+    bool pop_swap(T & value);
+    // Swap up to count values from the front into values, and pop
+    // them.  Return the number of values popped.
+    std::size_t pop_swap(T * values, std::size_t count);
+
+    // Writer functions.  These return false if the buffer is full.
+    bool push(const T &);
+    // Swap value into the back of the buffer.  value is left with
+    // the slot's previous value.
+    bool push_swap(T & value);
+
+private:
+    static std::size_t round_capacity(std::size_t capacity);
+
+    std::size_t load_front() const
+    {
+	return __atomic_load_n(&front_, __ATOMIC_ACQUIRE);
+    }
+    std::size_t load_back() const
+    {
+	return __atomic_load_n(&back_, __ATOMIC_ACQUIRE);
+    }
+
+    std::size_t mask_;
+    T * buffer_;
+    // The indices are written by different threads, so keep them
+    // in separate cache lines
+    std::size_t front_ __attribute__((aligned(64)));
+    std::size_t back_ __attribute__((aligned(64)));
+};
+
+template<typename T>
+std::size_t spsc_ring_buffer<T>::round_capacity(std::size_t capacity)
+{
+    std::size_t result = 1;
+    while (result < capacity)
+	result <<= 1;
+    return result;
+}
+
+template<typename T>
+spsc_ring_buffer<T>::spsc_ring_buffer(std::size_t capacity)
+    : mask_(round_capacity(capacity) - 1),
+      buffer_(new T[mask_ + 1]),
+      front_(0), back_(0)
+{}
+
+template<typename T>
+spsc_ring_buffer<T>::spsc_ring_buffer(const spsc_ring_buffer & other)
+    : mask_(other.mask_),
+      buffer_(new T[mask_ + 1]),
+      front_(other.front_), back_(other.back_)
+{
+    try
+    {
+	std::copy(other.buffer_, other.buffer_ + mask_ + 1, buffer_);
+    }
+    catch (...)
+    {
+	delete[] buffer_;
+	throw;
+    }
+}
+
+template<typename T>
+spsc_ring_buffer<T>::~spsc_ring_buffer()
+{
+    delete[] buffer_;
+}
+
+template<typename T>
+spsc_ring_buffer<T> &
+spsc_ring_buffer<T>::operator=(const spsc_ring_buffer & other)
+{
+    spsc_ring_buffer temp(other);
+    std::swap(mask_, temp.mask_);
+    std::swap(buffer_, temp.buffer_);
+    front_ = temp.front_;
+    back_ = temp.back_;
+    return *this;
+}
+
+template<typename T>
+std::size_t spsc_ring_buffer<T>::size() const
+{
+    // Read front_ first so that the result cannot be negative
+    std::size_t front = load_front();
+    return load_back() - front;
+}
+
+template<typename T>
+bool spsc_ring_buffer<T>::pop()
+{
+    std::size_t front = front_;
+    if (front == load_back())
+	return false;
+    buffer_[front & mask_] = T();
+    __atomic_store_n(&front_, front + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+template<typename T>
+bool spsc_ring_buffer<T>::pop_swap(T & value)
+{
+    return pop_swap(&value, 1) != 0;
+}
+
+template<typename T>
+std::size_t spsc_ring_buffer<T>::pop_swap(T * values, std::size_t count)
+{
+    using std::swap;
+    std::size_t front = front_;
+    count = std::min(count, load_back() - front);
+    for (std::size_t i = 0; i != count; ++i)
+	swap(values[i], buffer_[(front + i) & mask_]);
+    __atomic_store_n(&front_, front + count, __ATOMIC_RELEASE);
+    return count;
+}
+
+template<typename T>
+bool spsc_ring_buffer<T>::push(const T & value)
+{
+    std::size_t back = back_;
+    if (back - load_front() > mask_)
+	return false;
+    buffer_[back & mask_] = value;
+    __atomic_store_n(&back_, back + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+template<typename T>
+bool spsc_ring_buffer<T>::push_swap(T & value)
+{
+    using std::swap;
+    std::size_t back = back_;
+    if (back - load_front() > mask_)
+	return false;
+    swap(buffer_[back & mask_], value);
+    __atomic_store_n(&back_, back + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
 #endif // !defined(DVSWITCH_RING_BUFFER_HPP)
@@ -3,6 +3,7 @@
 
 // Server for the original network protocol
 
+#include <algorithm>
 #include <cstring>
 #include <functional>
 #include <iostream>
@@ -16,6 +17,7 @@
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -26,6 +28,7 @@
 #include "mixer.hpp"
 #include "os_error.hpp"
 #include "protocol.h"
+#include "ring_buffer.hpp"
 #include "server.hpp"
 #include "socket.h"
 
@@ -33,7 +36,8 @@ namespace
 {
     // Numbers used in the message pipe
     enum {
-	message_quit = -1
+	message_quit = -1,
+	message_sinks = -2	// some sinks have frames to send
     };
 }
 
@@ -51,6 +55,9 @@ public:
     virtual ~connection() {}
     connection * do_receive();
     virtual send_status do_send() { return send_failed; }
+    // Return whether the connection has queued data that it was
+    // not asked to send through schedule_send()
+    virtual bool has_queued_data() { return false; }
 
 protected:
     struct receive_buffer
@@ -141,16 +148,25 @@ public:
 private:
     struct queue_elem
     {
+	queue_elem() : overflow_before(false) {}
 	dv_frame_ptr frame;
 	bool overflow_before;
+	// Used by spsc_ring_buffer, to avoid copying
+	friend void swap(queue_elem & left, queue_elem & right)
+	{
+	    left.frame.swap(right.frame);
+	    std::swap(left.overflow_before, right.overflow_before);
+	}
     };
 
     virtual send_status do_send();
+    virtual bool has_queued_data();
     virtual receive_buffer get_receive_buffer();
     virtual connection * handle_complete_receive();
     virtual std::ostream & print_identity(std::ostream &);
 
     virtual void put_frame(const dv_frame_ptr & frame);
+    virtual void end_frame();
 
     receive_buffer handle_unexpected_input();
 
@@ -158,20 +174,26 @@ private:
     bool will_record_;
     bool is_recording_;
     mixer::sink_id sink_id_;
+    // Used only by the server thread: the frame being sent, and
+    // how much of it has been sent
+    queue_elem current_;
     std::size_t frame_pos_;
 
-    boost::mutex mutex_; // controls access to the following
-    ring_buffer<queue_elem> queue_;
+    // Written by the mixer and read by the server thread
+    spsc_ring_buffer<queue_elem> queue_;
+    // Used only by the mixer
     bool overflowed_;
 };
 
 // server implementation
 
 server::server(const std::string & host, const std::string & port,
-	       mixer & mixer)
+	       mixer & mixer, const mixer::source_settings & source_settings)
     : mixer_(mixer),
+      source_settings_(source_settings),
       listen_socket_(create_listening_socket(host.c_str(), port.c_str())),
-      message_pipe_(O_NONBLOCK, O_NONBLOCK)
+      message_pipe_(O_NONBLOCK, O_NONBLOCK),
+      sinks_pending_(false)
 {
     server_thread_.reset(new boost::thread(boost::bind(&server::serve, this)));
 }
@@ -223,6 +245,14 @@ void server::serve()
 		{
 		    if (messages[i] == message_quit)
 			return;
+		    if (messages[i] == message_sinks)
+		    {
+			for (std::size_t j = 0; j != connections.size(); ++j)
+			    if (connections[j]->has_queued_data())
+				poll_fds[poll_index_clients + j].events
+				    |= POLLOUT;
+			continue;
+		    }
 		    // otherwise message is the number of a file
 		    // descriptor we want to send on
 		    for (std::size_t j = poll_index_clients;
@@ -314,6 +344,18 @@ void server::serve()
     }
 }
 
+void server::wake_sinks()
+{
+    if (__atomic_exchange_n(&sinks_pending_, false, __ATOMIC_ACQ_REL))
+    {
+	static const int message = message_sinks;
+	os_check_zero(
+	    "write",
+	    write(message_pipe_.writer.get(), &message, sizeof(int))
+	    - sizeof(int));
+    }
+}
+
 // connection
 
 server::connection::connection(server & server, auto_fd socket)
@@ -434,7 +476,7 @@ server::source_connection::source_connection(server & server, auto_fd socket,
       first_sequence_(true),
       wants_act_(wants_act)
 {
-    mixer::source_settings settings;
+    mixer::source_settings settings(server_.source_settings_);
     union {
 	struct sockaddr addr;
 	char addr_buf[40];
@@ -530,9 +572,18 @@ server::connection * server::source_connection::handle_complete_receive()
 {
     if (!first_sequence_)
     {
- 	server_.mixer_.put_frame(source_id_, frame_);
- 	frame_.reset();
- 	frame_ = allocate_dv_frame();
+	// If the pool is exhausted, drop this frame and receive the
+	// next one into the same buffer rather than stalling every
+	// connection.
+	dv_frame_ptr next_frame = try_allocate_dv_frame();
+	if (next_frame)
+	{
+	    frame_->have_audio_levels =
+		dv_buffer_get_audio_levels(frame_->buffer,
+					   &frame_->audio_levels);
+	    server_.mixer_.put_frame(source_id_, frame_);
+	    frame_.swap(next_frame);
+	}
     }
 
     first_sequence_ = !first_sequence_;
@@ -571,23 +622,19 @@ server::connection::send_status server::sink_connection::do_send()
 
     do
     {
-	struct queue_elem elem;
+	if (finished_frame)
 	{
-	    boost::mutex::scoped_lock lock(mutex_);
-	    if (finished_frame)
-	    {
-		if (will_record_)
-		    is_recording_ = queue_.front().frame->do_record;
-		queue_.pop();
-		finished_frame = false;
-	    }
-	    if (queue_.empty())
-	    {
-		result = sent_all;
-		break;
-	    }
-	    elem = queue_.front();
+	    if (will_record_)
+		is_recording_ = current_.frame->do_record;
+	    current_ = queue_elem();
+	    finished_frame = false;
 	}
+	if (!current_.frame && !queue_.pop_swap(current_))
+	{
+	    result = sent_all;
+	    break;
+	}
+	const queue_elem & elem = current_;
 
 	if (will_record_ && !is_recording_ && !elem.frame->do_record)
 	{
@@ -596,7 +643,7 @@ server::connection::send_status server::sink_connection::do_send()
 	}
 
 	uint8_t frame_header[SINK_FRAME_HEADER_SIZE] = {};
-	iovec vector[2];
+	iovec vector[1 + DV_FRAME_IOVEC_MAX];
 	int vector_size;
 	std::size_t frame_size;
 
@@ -626,10 +673,10 @@ server::connection::send_status server::sink_connection::do_send()
 
 	if (!will_record_ || elem.frame->do_record)
 	{
-	    vector[vector_size].iov_base = elem.frame->buffer;
-	    vector[vector_size].iov_len =
-		dv_frame_system(elem.frame.get())->size;
-	    ++vector_size;
+	    // A repeated frame shares its video blocks with an
+	    // earlier frame, so may need to be gathered
+	    vector_size += dv_frame_get_iovec(elem.frame.get(),
+					      vector + vector_size);
 	    frame_size += dv_frame_system(elem.frame.get())->size;
 	}
 
@@ -690,34 +737,39 @@ std::ostream & server::sink_connection::print_identity(std::ostream & os)
     return os << "sink " << 1 + sink_id_;
 }
 
+bool server::sink_connection::has_queued_data()
+{
+    return !queue_.empty();
+}
+
 void server::sink_connection::put_frame(const dv_frame_ptr & frame)
 {
-    bool was_empty = false;
+    queue_elem elem;
+    elem.frame = frame;
+    elem.overflow_before = overflowed_;
+    if (!queue_.push_swap(elem))
     {
-	boost::mutex::scoped_lock lock(mutex_);
-	if (queue_.full())
+	if (!overflowed_)
 	{
-	    if (!overflowed_)
-	    {
-		std::cerr << "WARN: ";
-		print_identity(std::cerr) << " overflowed\n";
-		overflowed_ = true;
-	    }
+	    std::cerr << "WARN: ";
+	    print_identity(std::cerr) << " overflowed\n";
+	    overflowed_ = true;
 	}
-	else
+    }
+    else
+    {
+	if (overflowed_)
 	{
-	    struct queue_elem elem = { frame, overflowed_ };
-	    if (overflowed_)
-	    {
-		std::cout << "INFO: ";
-		print_identity(std::cout) << " recovered\n";
-		overflowed_ = false;
-	    }
-	    if (queue_.empty())
-		was_empty = true;
-	    queue_.push(elem);
+	    std::cout << "INFO: ";
+	    print_identity(std::cout) << " recovered\n";
+	    overflowed_ = false;
 	}
+	__atomic_store_n(&server_.sinks_pending_, true, __ATOMIC_RELEASE);
     }
-    if (was_empty)
-	schedule_send();
+}
+
+void server::sink_connection::end_frame()
+{
+    // The server thread is woken once for all sinks
+    server_.wake_sinks();
 }
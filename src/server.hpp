@@ -18,7 +18,10 @@
 class server
 {
 public:
-    server(const std::string & host, const std::string & port, mixer & mixer);
+    // Sources connecting to the server are added to the mixer with
+    // the given settings, apart from their names and media types.
+    server(const std::string & host, const std::string & port, mixer & mixer,
+	   const mixer::source_settings & source_settings);
     ~server();
 
 private:
@@ -28,10 +31,15 @@ private:
     class sink_connection;
 
     void serve();
+    // Wake the server thread if any sink has been given frames
+    // since it was last woken.  Called from the mixer.
+    void wake_sinks();
 
     mixer & mixer_;
+    mixer::source_settings source_settings_;
     auto_fd listen_socket_;
     auto_pipe message_pipe_;
+    bool sinks_pending_; // updated atomically
     std::auto_ptr<boost::thread> server_thread_;
 };
 
@@ -4,6 +4,7 @@
 // The source management dialog
 
 #include <gtkmm/messagedialog.h>
+#include <gtkmm/spinbutton.h>
 #include <gtkmm/table.h>
 
 #include "sources_dialog.hpp"
@@ -67,6 +68,10 @@ private:
     Gtk::Entry name_entry_;
     Gtk::Label url_label_;
     Gtk::Entry url_entry_;
+    Gtk::Label min_buffer_label_;
+    Gtk::SpinButton min_buffer_button_;
+    Gtk::Label max_buffer_label_;
+    Gtk::SpinButton max_buffer_button_;
     Gtk::CheckButton video_button_;
     Gtk::CheckButton audio_button_;
 };
@@ -75,6 +80,8 @@ source_add_dialog::source_add_dialog(Gtk::Window & window)
     : Dialog("Add Source", window, /*modal=*/true),
       name_label_("Name"),
       url_label_("URL"),
+      min_buffer_label_("Minimum buffer (frames)"),
+      max_buffer_label_("Maximum buffer (frames)"),
       video_button_("Use video"),
       audio_button_("Use audio")
 {
@@ -98,6 +105,27 @@ source_add_dialog::source_add_dialog(Gtk::Window & window)
     url_entry_.show();
     table_.attach(url_entry_, 1, 2, 1, 2, Gtk::FILL | Gtk::EXPAND, Gtk::FILL);
 
+    // Initialise the buffer limits to the mixer's defaults
+    mixer::source_settings defaults;
+
+    min_buffer_label_.show();
+    table_.attach(min_buffer_label_, 0, 1, 2, 3, Gtk::FILL, Gtk::FILL);
+
+    min_buffer_button_.set_range(1, 25);
+    min_buffer_button_.set_increments(1, 5);
+    min_buffer_button_.set_value(defaults.min_queue_len);
+    min_buffer_button_.show();
+    table_.attach(min_buffer_button_, 1, 2, 2, 3, Gtk::FILL, Gtk::FILL);
+
+    max_buffer_label_.show();
+    table_.attach(max_buffer_label_, 0, 1, 3, 4, Gtk::FILL, Gtk::FILL);
+
+    max_buffer_button_.set_range(1, 25);
+    max_buffer_button_.set_increments(1, 5);
+    max_buffer_button_.set_value(defaults.max_queue_len);
+    max_buffer_button_.show();
+    table_.attach(max_buffer_button_, 1, 2, 3, 4, Gtk::FILL, Gtk::FILL);
+
     table_.show();
     vbox.add(table_);
 
@@ -113,6 +141,10 @@ source_add_dialog::source_add_dialog(Gtk::Window & window)
 	sigc::mem_fun(*this, &source_add_dialog::handle_change));
     url_entry_.signal_changed().connect(
 	sigc::mem_fun(*this, &source_add_dialog::handle_change));
+    min_buffer_button_.signal_value_changed().connect(
+	sigc::mem_fun(*this, &source_add_dialog::handle_change));
+    max_buffer_button_.signal_value_changed().connect(
+	sigc::mem_fun(*this, &source_add_dialog::handle_change));
     video_button_.signal_toggled().connect(
 	sigc::mem_fun(*this, &source_add_dialog::handle_change));
     audio_button_.signal_toggled().connect(
@@ -130,10 +162,12 @@ void source_add_dialog::handle_change()
 
 bool source_add_dialog::is_valid() const
 {
-    // Name and URL must be set; one or both of video or audio must be
-    // enabled
+    // Name and URL must be set; the buffer limits must be in order;
+    // one or both of video or audio must be enabled
     return (name_entry_.get_text_length() != 0 &&
 	    url_entry_.get_text_length() != 0 &&
+	    (min_buffer_button_.get_value_as_int() <=
+	     max_buffer_button_.get_value_as_int()) &&
 	    (video_button_.get_active() ||
 	     audio_button_.get_active()));
 }
@@ -145,6 +179,8 @@ mixer::source_settings source_add_dialog::get_settings() const
     result.url = url_entry_.get_text();
     result.use_video = video_button_.get_active();
     result.use_audio = audio_button_.get_active();
+    result.min_queue_len = min_buffer_button_.get_value_as_int();
+    result.max_queue_len = max_buffer_button_.get_value_as_int();
     return result;
 }
 
@@ -6,6 +6,13 @@
 #include <assert.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
 #include <libavutil/pixdesc.h>
 
 #include "video_effect.h"
@@ -16,6 +23,51 @@ enum {
     chroma_bias = 128 // neutral level (chroma components are signed)
 };
 
+static enum video_effect_simd selected_simd = video_effect_simd_auto;
+
+static bool simd_supported(enum video_effect_simd simd)
+{
+    switch (simd)
+    {
+    case video_effect_simd_auto:
+    case video_effect_simd_none:
+	return true;
+#ifdef __SSE2__
+    case video_effect_simd_sse2:
+	return true;
+    case video_effect_simd_avx2:
+	return __builtin_cpu_supports("avx2");
+#endif
+#ifdef __ARM_NEON
+    case video_effect_simd_neon:
+	return true;
+#endif
+    default:
+	return false;
+    }
+}
+
+bool video_effect_select_simd(enum video_effect_simd simd)
+{
+    if (!simd_supported(simd))
+	return false;
+    selected_simd = simd;
+    return true;
+}
+
+static enum video_effect_simd get_simd(void)
+{
+    if (selected_simd != video_effect_simd_auto)
+	return selected_simd;
+    if (simd_supported(video_effect_simd_avx2))
+	return video_effect_simd_avx2;
+    if (simd_supported(video_effect_simd_sse2))
+	return video_effect_simd_sse2;
+    if (simd_supported(video_effect_simd_neon))
+	return video_effect_simd_neon;
+    return video_effect_simd_none;
+}
+
 void video_effect_show_title_safe(struct raw_frame_ref dest)
 {
     int chroma_shift_horiz, chroma_shift_vert;
@@ -97,8 +149,33 @@ void video_effect_pic_in_pic(struct raw_frame_ref dest,
 			     struct raw_frame_ref source,
 			     struct rectangle s_rect)
 {
+    video_effect_pic_in_pic_band(dest, d_rect, source, s_rect,
+				 0, dest.height);
+}
+
+void video_effect_pic_in_pic_band(struct raw_frame_ref dest,
+				  struct rectangle d_rect,
+				  struct raw_frame_ref source,
+				  struct rectangle s_rect,
+				  unsigned band_top, unsigned band_bottom)
+{
+    struct video_effect_pic_in_pic_scaler scaler;
+    video_effect_pic_in_pic_scaler_init(&scaler, dest.pix_fmt, d_rect, s_rect);
+    video_effect_pic_in_pic_scaler_band(&scaler, dest, source,
+					band_top, band_bottom);
+}
+
+void video_effect_pic_in_pic_scaler_init(
+    struct video_effect_pic_in_pic_scaler * scaler,
+    enum PixelFormat pix_fmt,
+    struct rectangle d_rect, struct rectangle s_rect)
+{
+    scaler->pix_fmt = pix_fmt;
+    scaler->d_rect = d_rect;
+    scaler->s_rect = s_rect;
+
     int chroma_shift_horiz, chroma_shift_vert;
-    av_pix_fmt_get_chroma_sub_sample(dest.pix_fmt,
+    av_pix_fmt_get_chroma_sub_sample(pix_fmt,
                                      &chroma_shift_horiz, &chroma_shift_vert);
 
     // Round coordinates so they include whole numbers of chroma pixels
@@ -114,39 +191,29 @@ void video_effect_pic_in_pic(struct raw_frame_ref dest,
     assert(s_rect.left >= 0 && s_rect.left < s_rect.right
 	   && s_rect.right <= FRAME_WIDTH);
     assert(s_rect.top >= 0 && s_rect.top < s_rect.bottom
-	   && (unsigned)s_rect.bottom <= source.height);
+	   && s_rect.bottom <= FRAME_HEIGHT_MAX);
     assert(d_rect.left >= 0 && d_rect.left <= d_rect.right
 	   && d_rect.right <= FRAME_WIDTH);
-    assert(d_rect.top >= 0 && d_rect.top <= d_rect.bottom
-	   && (unsigned)d_rect.bottom <= dest.height);
+    assert(d_rect.top >= 0 && d_rect.top <= d_rect.bottom);
+
+    scaler->s_rounded = s_rect;
+    scaler->d_rounded = d_rect;
 
     if (d_rect.left == d_rect.right || d_rect.top == d_rect.bottom)
 	return;
 
-    unsigned s_left = s_rect.left;
     unsigned s_width = s_rect.right - s_rect.left;
-    unsigned s_top = s_rect.top;
     unsigned s_height = s_rect.bottom - s_rect.top;
-    unsigned d_left = d_rect.left;
     unsigned d_width = d_rect.right - d_rect.left;
-    unsigned d_top = d_rect.top;
     unsigned d_height = d_rect.bottom - d_rect.top;
     assert(d_width <= s_width && d_height <= s_height);
 
-    // Scaling tables
-
-    struct weights {
-	// Weight of source column/row on current dest column/row
-	uint16_t cur;
-	// Weight of source column/row on next dest column/row, plus 1
-	// if this the last source column/row for this dest column/row.
-	uint16_t spill;
-    };
-    struct weights col_weights[FRAME_WIDTH];
-    struct weights row_weights[FRAME_HEIGHT_MAX];
+    struct video_effect_scale_weights * col_weights = scaler->col_weights;
+    struct video_effect_scale_weights * row_weights = scaler->row_weights;
     unsigned e, x, y;
-    uint32_t weight_scale = (((1ULL << 32) + s_width * s_height / 2)
-			     / (s_width * s_height));
+
+    scaler->weight_scale = (((1ULL << 32) + s_width * s_height / 2)
+			    / (s_width * s_height));
 
     e = 0;
     for (x = 0; x != s_width; ++x)
@@ -187,6 +254,254 @@ void video_effect_pic_in_pic(struct raw_frame_ref dest,
     assert(row_weights[s_height - 1].spill == 1);
     assert(row_weights[(s_height >> chroma_shift_vert) - 1].spill == 1);
 
+    // When each dest column covers exactly 2, 3 or 4 source columns
+    // the column weights are all equal and we can use a simpler
+    // horizontal pass
+    scaler->col_ratio = 0;
+    if (s_width == 2 * d_width || s_width == 3 * d_width
+	|| s_width == 4 * d_width)
+	scaler->col_ratio = s_width / d_width;
+}
+
+// Scaling kernels.  The picture is scaled by a horizontal pass over
+// each source row, producing a weighted sum for each dest column, and
+// a vertical pass that accumulates these into a row of sums for each
+// dest row.  The sums are exact, so the kernels can be mixed freely.
+
+static void scale_row_horiz_c(uint32_t * sums, const uint8_t * source,
+			      unsigned s_width,
+			      const struct video_effect_scale_weights * weights)
+{
+    // This is written without branches, since whether a column
+    // spills is unpredictable for most ratios.  The sum is stored
+    // after every column but the pointer only advances on a spill.
+    uint32_t sum = 0;
+    for (unsigned x = 0; x != s_width; ++x)
+    {
+	unsigned value = source[x];
+	unsigned spill = weights[x].spill;
+	sum += value * weights[x].cur;
+	*sums = sum;
+	sums += (spill != 0);
+	sum = spill ? value * (spill - 1) : sum;
+    }
+}
+
+static void scale_row_horiz_ratio_c(uint32_t * sums, const uint8_t * source,
+				    unsigned d_width, unsigned ratio,
+				    unsigned weight)
+{
+    switch (ratio)
+    {
+    case 2:
+	for (unsigned x = 0; x != d_width; ++x, source += 2)
+	    sums[x] = (source[0] + source[1]) * weight;
+	break;
+    case 3:
+	for (unsigned x = 0; x != d_width; ++x, source += 3)
+	    sums[x] = (source[0] + source[1] + source[2]) * weight;
+	break;
+    case 4:
+	for (unsigned x = 0; x != d_width; ++x, source += 4)
+	    sums[x] = (source[0] + source[1] + source[2] + source[3]) * weight;
+	break;
+    default:
+	assert(0);
+    }
+}
+
+static void scale_row_vert_c(uint32_t * acc, const uint32_t * sums,
+			     unsigned d_width, unsigned weight)
+{
+    for (unsigned x = 0; x != d_width; ++x)
+	acc[x] += sums[x] * weight;
+}
+
+static void scale_row_output_c(uint8_t * dest, const uint32_t * acc,
+			       unsigned d_width, uint32_t weight_scale)
+{
+    for (unsigned x = 0; x != d_width; ++x)
+	dest[x] = (acc[x] * (uint64_t)weight_scale + (1U << 31)) >> 32;
+}
+
+#ifdef __SSE2__
+
+// Multiply unsigned 32-bit lanes by an unsigned 32-bit constant,
+// giving the low 32 bits of each product
+static inline __m128i mul_epu32_low(__m128i a, __m128i b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), b);
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+			      _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static void scale_row_horiz_ratio_sse2(uint32_t * sums, const uint8_t * source,
+				       unsigned d_width, unsigned ratio,
+				       unsigned weight)
+{
+    const __m128i low_bytes = _mm_set1_epi16(0xff);
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i weight_lo = _mm_set1_epi16(weight);
+    unsigned x = 0;
+
+    // 2:1 and 4:1 can be done with pairwise additions, giving 8 or 4
+    // 16-bit sums per 16 source bytes, which are then widened while
+    // being multiplied by the weight
+    if (ratio == 2)
+    {
+	for (; x + 8 <= d_width; x += 8, source += 16)
+	{
+	    __m128i s = _mm_loadu_si128((const __m128i *)source);
+	    __m128i pairs = _mm_add_epi16(_mm_and_si128(s, low_bytes),
+					  _mm_srli_epi16(s, 8));
+	    __m128i lo = _mm_mullo_epi16(pairs, weight_lo);
+	    __m128i hi = _mm_mulhi_epu16(pairs, weight_lo);
+	    _mm_storeu_si128((__m128i *)(sums + x), _mm_unpacklo_epi16(lo, hi));
+	    _mm_storeu_si128((__m128i *)(sums + x + 4),
+			     _mm_unpackhi_epi16(lo, hi));
+	}
+    }
+    else if (ratio == 4)
+    {
+	const __m128i weight_32 = _mm_set1_epi32(weight);
+	for (; x + 4 <= d_width; x += 4, source += 16)
+	{
+	    __m128i s = _mm_loadu_si128((const __m128i *)source);
+	    __m128i pairs = _mm_add_epi16(_mm_and_si128(s, low_bytes),
+					  _mm_srli_epi16(s, 8));
+	    __m128i quads = _mm_madd_epi16(pairs, ones);
+	    _mm_storeu_si128((__m128i *)(sums + x),
+			     mul_epu32_low(quads, weight_32));
+	}
+    }
+
+    if (x != d_width)
+	scale_row_horiz_ratio_c(sums + x, source, d_width - x, ratio, weight);
+}
+
+static void scale_row_vert_sse2(uint32_t * acc, const uint32_t * sums,
+				unsigned d_width, unsigned weight)
+{
+    const __m128i weight_32 = _mm_set1_epi32(weight);
+    unsigned x = 0;
+
+    for (; x + 4 <= d_width; x += 4)
+    {
+	__m128i a = _mm_loadu_si128((const __m128i *)(acc + x));
+	__m128i s = _mm_loadu_si128((const __m128i *)(sums + x));
+	_mm_storeu_si128((__m128i *)(acc + x),
+			 _mm_add_epi32(a, mul_epu32_low(s, weight_32)));
+    }
+
+    scale_row_vert_c(acc + x, sums + x, d_width - x, weight);
+}
+
+static void scale_row_output_sse2(uint8_t * dest, const uint32_t * acc,
+				  unsigned d_width, uint32_t weight_scale)
+{
+    const __m128i scale = _mm_set1_epi32(weight_scale);
+    const __m128i round = _mm_set1_epi64x(1ULL << 31);
+    const __m128i low_byte = _mm_set1_epi32(0xff);
+    unsigned x = 0;
+
+    for (; x + 8 <= d_width; x += 8)
+    {
+	__m128i result[2];
+	for (unsigned i = 0; i != 2; ++i)
+	{
+	    __m128i a = _mm_loadu_si128((const __m128i *)(acc + x + 4 * i));
+	    // Rounded high halves of the 64-bit products, in the low
+	    // half of each 64-bit lane for the even and odd values
+	    __m128i even = _mm_srli_epi64(
+		_mm_add_epi64(_mm_mul_epu32(a, scale), round), 32);
+	    __m128i odd = _mm_add_epi64(
+		_mm_mul_epu32(_mm_srli_epi64(a, 32), scale), round);
+	    // Merge and truncate to 8 bits as the C version does
+	    result[i] = _mm_and_si128(
+		_mm_or_si128(even, _mm_and_si128(odd,
+						 _mm_set_epi32(-1, 0, -1, 0))),
+		low_byte);
+	}
+	__m128i words = _mm_packs_epi32(result[0], result[1]);
+	_mm_storel_epi64((__m128i *)(dest + x),
+			 _mm_packus_epi16(words, words));
+    }
+
+    scale_row_output_c(dest + x, acc + x, d_width - x, weight_scale);
+}
+
+#endif // __SSE2__
+
+void video_effect_pic_in_pic_scaler_band(
+    const struct video_effect_pic_in_pic_scaler * scaler,
+    struct raw_frame_ref dest,
+    struct raw_frame_ref source,
+    unsigned band_top, unsigned band_bottom)
+{
+    int chroma_shift_horiz, chroma_shift_vert;
+    av_pix_fmt_get_chroma_sub_sample(dest.pix_fmt,
+                                     &chroma_shift_horiz, &chroma_shift_vert);
+
+    const struct rectangle s_rect = scaler->s_rounded;
+    const struct rectangle d_rect = scaler->d_rounded;
+
+    assert(dest.pix_fmt == scaler->pix_fmt
+	   && source.pix_fmt == scaler->pix_fmt);
+    assert((unsigned)s_rect.bottom <= source.height);
+    assert((unsigned)d_rect.bottom <= dest.height);
+    assert(band_top <= band_bottom && band_bottom <= dest.height);
+    assert(!(band_top & ((1U << chroma_shift_vert) - 1)));
+    assert(!(band_bottom & ((1U << chroma_shift_vert) - 1))
+	   || band_bottom == dest.height);
+
+    // Convert the band to dest rows relative to the dest rectangle
+    band_top = (band_top > (unsigned)d_rect.top) ? band_top - d_rect.top : 0;
+    band_bottom = (band_bottom > (unsigned)d_rect.top)
+	? band_bottom - d_rect.top : 0;
+
+    if (d_rect.left == d_rect.right || d_rect.top == d_rect.bottom
+	|| band_top >= band_bottom
+	|| band_top >= (unsigned)(d_rect.bottom - d_rect.top))
+	return;
+
+    unsigned s_left = s_rect.left;
+    unsigned s_width = s_rect.right - s_rect.left;
+    unsigned s_top = s_rect.top;
+    unsigned s_height = s_rect.bottom - s_rect.top;
+    unsigned d_left = d_rect.left;
+    unsigned d_width = d_rect.right - d_rect.left;
+    unsigned d_top = d_rect.top;
+    unsigned d_height = d_rect.bottom - d_rect.top;
+
+    const struct video_effect_scale_weights * col_weights =
+	scaler->col_weights;
+    const struct video_effect_scale_weights * row_weights =
+	scaler->row_weights;
+    const uint32_t weight_scale = scaler->weight_scale;
+    const unsigned col_ratio = scaler->col_ratio;
+
+    void (*scale_row_horiz_ratio)(uint32_t *, const uint8_t *,
+				  unsigned, unsigned, unsigned);
+    void (*scale_row_vert)(uint32_t *, const uint32_t *, unsigned, unsigned);
+    void (*scale_row_output)(uint8_t *, const uint32_t *, unsigned, uint32_t);
+    switch (get_simd())
+    {
+#ifdef __SSE2__
+    case video_effect_simd_sse2:
+    case video_effect_simd_avx2:
+	scale_row_horiz_ratio = scale_row_horiz_ratio_sse2;
+	scale_row_vert = scale_row_vert_sse2;
+	scale_row_output = scale_row_output_sse2;
+	break;
+#endif
+    default:
+	scale_row_horiz_ratio = scale_row_horiz_ratio_c;
+	scale_row_vert = scale_row_vert_c;
+	scale_row_output = scale_row_output_c;
+	break;
+    }
+
     for (unsigned plane = 0; plane != 3; ++plane)
     {
 	if (plane == 1)
@@ -199,111 +514,220 @@ void video_effect_pic_in_pic(struct raw_frame_ref dest,
 	    d_height >>= chroma_shift_vert;
 	    s_top >>= chroma_shift_vert;
 	    s_height >>= chroma_shift_vert;
+	    band_top >>= chroma_shift_vert;
+	    band_bottom = (band_bottom + (1U << chroma_shift_vert) - 1)
+		>> chroma_shift_vert;
 	}
 	uint8_t * dest_p = (dest.planes.data[plane]
-			    + d_top * dest.planes.linesize[plane] + d_left);
-	const unsigned dest_gap = dest.planes.linesize[plane] - d_width;
-	uint32_t row_buffer[FRAME_WIDTH], * row_p;
+			    + (d_top + band_top) * dest.planes.linesize[plane]
+			    + d_left);
+	const unsigned dest_linesize = dest.planes.linesize[plane];
+	uint32_t row_buffer[FRAME_WIDTH], col_sums[FRAME_WIDTH];
 	memset(row_buffer, 0, d_width * sizeof(uint32_t));
 
-	// Loop over source rows
-	for (y = 0; ; ++y)
+	// Loop over source rows.  Rows which only contribute to dest
+	// rows above the band are skipped.
+	unsigned d_y = 0;
+	for (unsigned y = 0; ; ++y)
 	{
-	    unsigned row_weight = row_weights[y].cur;
 	    unsigned row_spill = row_weights[y].spill;
-
-	    // Loop over source columns
+	    bool have_sums = false;
 	    const uint8_t * source_p =
 		source.planes.data[plane]
 		+ source.planes.linesize[plane] * (s_top + y) + s_left;
-	    row_p = row_buffer;
-	    uint32_t value_sum = *row_p;
-	    for (x = 0; x != s_width; ++x)
+
+	    if (d_y >= band_top)
 	    {
-		unsigned value_rw = *source_p++ * row_weight;
-		value_sum += value_rw * col_weights[x].cur;
-		if (col_weights[x].spill)
-		{
-		    *row_p++ = value_sum;
-		    value_sum = *row_p + value_rw * (col_weights[x].spill - 1);
-		}
+		if (col_ratio)
+		    scale_row_horiz_ratio(col_sums, source_p, d_width,
+					  col_ratio, col_weights[0].cur);
+		else
+		    scale_row_horiz_c(col_sums, source_p, s_width,
+				      col_weights);
+		have_sums = true;
+		scale_row_vert(row_buffer, col_sums, d_width,
+			       row_weights[y].cur);
 	    }
 
 	    if (!row_spill)
 		continue;
 
-	    // Spit out destination row
-	    row_p = row_buffer;
-	    for (x = 0; x != d_width; ++x)
-		*dest_p++ = (*row_p++ * (uint64_t)weight_scale
-			     + (1U << 31)) >> 32;
+	    if (d_y >= band_top)
+	    {
+		// Spit out destination row
+		scale_row_output(dest_p, row_buffer, d_width, weight_scale);
+		dest_p += dest_linesize;
+	    }
 
-	    if (y == s_height - 1)
+	    ++d_y;
+	    if (y == s_height - 1 || d_y == band_bottom)
 		break;
 
-	    dest_p += dest_gap;
-
-	    // Scale source row to next dest row if it overlaps
-	    // otherwise just reinitialise row buffer
-	    row_weight = row_spill - 1;
-	    if (!row_weight)
+	    if (d_y >= band_top)
 	    {
+		// Scale source row to next dest row if it overlaps
+		// otherwise just reinitialise row buffer
 		memset(row_buffer, 0, d_width * sizeof(uint32_t));
-	    }
-	    else
-	    {
-		source_p -= s_width;
-		row_p = row_buffer;
-		uint32_t value_sum = 0;
-		for (x = 0; x != s_width; ++x)
+		if (row_spill > 1)
 		{
-		    unsigned value_rw = *source_p++ * row_weight;
-		    value_sum += value_rw * col_weights[x].cur;
-		    if (col_weights[x].spill)
+		    if (!have_sums)
 		    {
-			*row_p++ = value_sum;
-			value_sum = value_rw * (col_weights[x].spill - 1);
+			if (col_ratio)
+			    scale_row_horiz_ratio(col_sums, source_p, d_width,
+						  col_ratio,
+						  col_weights[0].cur);
+			else
+			    scale_row_horiz_c(col_sums, source_p, s_width,
+					      col_weights);
 		    }
+		    scale_row_vert(row_buffer, col_sums, d_width,
+				   row_spill - 1);
 		}
 	    }
 	}
     }
 }
 
+// Fade kernels.  Each blends one row of sec into dest, computing
+// dest += (uint8_t)((uint16_t)(scale * (sec - dest)) >> 8) for each
+// byte; the SIMD versions are bit-exact with the plain C version.
+
+static void fade_row_c(uint8_t * dest, const uint8_t * sec, unsigned width,
+		       uint8_t scale)
+{
+    for (unsigned x = 0; x != width; ++x)
+    {
+	uint16_t tmp = scale * (sec[x] - dest[x]);
+	dest[x] += (uint8_t)(tmp >> 8);
+    }
+}
+
+#ifdef __SSE2__
+
+static void fade_row_sse2(uint8_t * dest, const uint8_t * sec, unsigned width,
+			  uint8_t scale)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i scale_16 = _mm_set1_epi16(scale);
+    unsigned x = 0;
+
+    for (; x + 16 <= width; x += 16)
+    {
+	__m128i d = _mm_loadu_si128((const __m128i *)(dest + x));
+	__m128i s = _mm_loadu_si128((const __m128i *)(sec + x));
+	// The low 16 bits of the product are exactly the C code's tmp
+	__m128i lo = _mm_mullo_epi16(
+	    _mm_sub_epi16(_mm_unpacklo_epi8(s, zero),
+			  _mm_unpacklo_epi8(d, zero)),
+	    scale_16);
+	__m128i hi = _mm_mullo_epi16(
+	    _mm_sub_epi16(_mm_unpackhi_epi8(s, zero),
+			  _mm_unpackhi_epi8(d, zero)),
+	    scale_16);
+	__m128i delta = _mm_packus_epi16(_mm_srli_epi16(lo, 8),
+					 _mm_srli_epi16(hi, 8));
+	_mm_storeu_si128((__m128i *)(dest + x), _mm_add_epi8(d, delta));
+    }
+
+    fade_row_c(dest + x, sec + x, width - x, scale);
+}
+
+__attribute__((target("avx2")))
+static void fade_row_avx2(uint8_t * dest, const uint8_t * sec, unsigned width,
+			  uint8_t scale)
+{
+    const __m256i scale_16 = _mm256_set1_epi16(scale);
+    const __m256i byte_mask = _mm256_set1_epi16(0xff);
+    unsigned x = 0;
+
+    for (; x + 16 <= width; x += 16)
+    {
+	__m256i d = _mm256_cvtepu8_epi16(
+	    _mm_loadu_si128((const __m128i *)(dest + x)));
+	__m256i s = _mm256_cvtepu8_epi16(
+	    _mm_loadu_si128((const __m128i *)(sec + x)));
+	__m256i delta = _mm256_srli_epi16(
+	    _mm256_mullo_epi16(_mm256_sub_epi16(s, d), scale_16), 8);
+	// Wrap the sum to 8 bits so that packus does not saturate it;
+	// the permute undoes the per-lane interleaving of packus
+	__m256i sum = _mm256_and_si256(_mm256_add_epi16(d, delta), byte_mask);
+	__m256i packed = _mm256_permute4x64_epi64(
+	    _mm256_packus_epi16(sum, sum), 0x08);
+	_mm_storeu_si128((__m128i *)(dest + x),
+			 _mm256_castsi256_si128(packed));
+    }
+
+    fade_row_c(dest + x, sec + x, width - x, scale);
+}
+
+#endif // __SSE2__
+
+#ifdef __ARM_NEON
+
+static void fade_row_neon(uint8_t * dest, const uint8_t * sec, unsigned width,
+			  uint8_t scale)
+{
+    const int16x8_t scale_16 = vdupq_n_s16(scale);
+    unsigned x = 0;
+
+    for (; x + 8 <= width; x += 8)
+    {
+	uint8x8_t d = vld1_u8(dest + x);
+	int16x8_t diff = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(sec + x), d));
+	uint16x8_t tmp = vreinterpretq_u16_s16(vmulq_s16(diff, scale_16));
+	vst1_u8(dest + x, vadd_u8(d, vshrn_n_u16(tmp, 8)));
+    }
+
+    fade_row_c(dest + x, sec + x, width - x, scale);
+}
+
+#endif // __ARM_NEON
+
 void video_effect_fade(struct raw_frame_ref dest,
 		       struct raw_frame_ref sec,
 		       uint8_t scale)
 {
-    int x, y, plane;
-    uint8_t *ptr_d, *ptr_s;
-    uint16_t tmp;
-    int width, height;
+    void (*fade_row)(uint8_t *, const uint8_t *, unsigned, uint8_t);
+    switch (get_simd())
+    {
+#ifdef __SSE2__
+    case video_effect_simd_sse2:
+	fade_row = fade_row_sse2;
+	break;
+    case video_effect_simd_avx2:
+	fade_row = fade_row_avx2;
+	break;
+#endif
+#ifdef __ARM_NEON
+    case video_effect_simd_neon:
+	fade_row = fade_row_neon;
+	break;
+#endif
+    default:
+	fade_row = fade_row_c;
+	break;
+    }
 
     int chroma_shift_horiz, chroma_shift_vert;
     av_pix_fmt_get_chroma_sub_sample(dest.pix_fmt,
                                      &chroma_shift_horiz, &chroma_shift_vert);
 
-    width = FRAME_WIDTH;
-    height = dest.height;
-    for (plane = 0; plane < 3; plane++)
+    unsigned width = FRAME_WIDTH;
+    unsigned height = dest.height;
+    for (int plane = 0; plane < 3; plane++)
     {
-	ptr_d = (dest.planes.data[plane]);
-	ptr_s = (sec.planes.data[plane]);
+	uint8_t * ptr_d = dest.planes.data[plane];
+	const uint8_t * ptr_s = sec.planes.data[plane];
 	if (plane == 1)
 	{
 	    width >>= chroma_shift_horiz;
 	    height >>= chroma_shift_vert;
 	}
-        for (y = 0; y < height; y++)
-        {
-	    for (x = 0; x < width; x++)
-	    {
-		tmp = scale * (*ptr_s - *ptr_d);
-		*ptr_d += (uint8_t)(tmp >> 8);
-		ptr_d++; ptr_s++;
-	    }
-	    ptr_d += dest.planes.linesize[plane] - width;
-	    ptr_s += dest.planes.linesize[plane] - width;
-        }
+	for (unsigned y = 0; y < height; y++)
+	{
+	    fade_row(ptr_d, ptr_s, width, scale);
+	    ptr_d += dest.planes.linesize[plane];
+	    ptr_s += dest.planes.linesize[plane];
+	}
     }
 }
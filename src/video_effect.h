@@ -10,6 +10,8 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
+
 #include "frame.h"
 #include "geometry.h"
 
@@ -20,10 +22,72 @@ void video_effect_pic_in_pic(struct raw_frame_ref dest,
 			     struct rectangle dest_rect,
                              struct raw_frame_ref source,
 			     struct rectangle source_rect);
+// As video_effect_pic_in_pic(), but only write dest rows from
+// band_top (inclusive) to band_bottom (exclusive).  This allows the
+// effect to be split between threads.  The band limits must be
+// multiples of the vertical chroma subsampling factor (except that
+// band_bottom may be the frame height).
+void video_effect_pic_in_pic_band(struct raw_frame_ref dest,
+				  struct rectangle dest_rect,
+				  struct raw_frame_ref source,
+				  struct rectangle source_rect,
+				  unsigned band_top, unsigned band_bottom);
+
+// Pic-in-pic with scaling tables set up in advance.  The tables
+// depend only on the rectangles and pixel format, so they can be
+// reused for a series of frames.
+struct video_effect_scale_weights
+{
+    // Weight of source column/row on current dest column/row
+    uint16_t cur;
+    // Weight of source column/row on next dest column/row, plus 1
+    // if this the last source column/row for this dest column/row.
+    uint16_t spill;
+};
+struct video_effect_pic_in_pic_scaler
+{
+    // Parameters as passed to video_effect_pic_in_pic_scaler_init()
+    enum PixelFormat pix_fmt;
+    struct rectangle d_rect, s_rect;
+    // Rectangles rounded to whole chroma pixels
+    struct rectangle d_rounded, s_rounded;
+    uint32_t weight_scale;
+    // Number of source columns per dest column if this is 2, 3 or 4,
+    // otherwise 0
+    unsigned col_ratio;
+    struct video_effect_scale_weights col_weights[FRAME_WIDTH];
+    struct video_effect_scale_weights row_weights[FRAME_HEIGHT_MAX];
+};
+void video_effect_pic_in_pic_scaler_init(
+    struct video_effect_pic_in_pic_scaler * scaler,
+    enum PixelFormat pix_fmt,
+    struct rectangle dest_rect, struct rectangle source_rect);
+// As video_effect_pic_in_pic_band(), using the given scaler
+void video_effect_pic_in_pic_scaler_band(
+    const struct video_effect_pic_in_pic_scaler * scaler,
+    struct raw_frame_ref dest,
+    struct raw_frame_ref source,
+    unsigned band_top, unsigned band_bottom);
+
 void video_effect_fade(struct raw_frame_ref dest,
 		       struct raw_frame_ref sec,
 		       uint8_t scale);
 
+// SIMD instruction sets that effects may use.  By default the best
+// one supported by the CPU is used.
+enum video_effect_simd
+{
+    video_effect_simd_auto,
+    video_effect_simd_none,
+    video_effect_simd_sse2,
+    video_effect_simd_avx2,
+    video_effect_simd_neon
+};
+
+// Select the instruction set to use, e.g. for testing.  Return false
+// if it is not supported.
+bool video_effect_select_simd(enum video_effect_simd);
+
 #ifdef __cplusplus
 }
 #endif
@@ -3,6 +3,9 @@
 
 // Gtkmm widget for displaying stereo VU-style volume meters
 
+#ifndef DVSWITCH_VU_METER_HPP
+#define DVSWITCH_VU_METER_HPP
+
 #include <gtkmm/drawingarea.h>
 
 #include "pcm.h"
@@ -22,3 +25,5 @@ private:
     int minimum_, maximum_, levels_[channel_count];
     int peaks_[channel_count], peak_timers_[channel_count];
 };
+
+#endif // !defined(DVSWITCH_VU_METER_HPP)
@@ -0,0 +1,123 @@
+// See the file "COPYING" for licence details.
+
+// Fixed pool of worker threads for data-parallel work
+
+#include <algorithm>
+#include <cassert>
+#include <exception>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+
+#include "worker_pool.hpp"
+
+worker_pool::worker_pool(unsigned thread_count)
+    : tasks_(0),
+      next_task_(0),
+      unfinished_count_(0),
+      stopping_(false)
+{
+    threads_.reserve(thread_count);
+    try
+    {
+	for (unsigned i = 0; i != thread_count; ++i)
+	    threads_.push_back(
+		new boost::thread(
+		    boost::bind(&worker_pool::run_worker, this, 1 + i)));
+    }
+    catch (...)
+    {
+	stop();
+	throw;
+    }
+}
+
+worker_pool::~worker_pool()
+{
+    stop();
+}
+
+void worker_pool::stop()
+{
+    {
+	boost::mutex::scoped_lock lock(mutex_);
+	stopping_ = true;
+	work_cond_.notify_all();
+    }
+
+    for (std::size_t i = 0; i != threads_.size(); ++i)
+    {
+	threads_[i]->join();
+	delete threads_[i];
+    }
+    threads_.clear();
+}
+
+void worker_pool::run(const std::vector<task> & tasks)
+{
+    if (tasks.empty())
+	return;
+
+    boost::mutex::scoped_lock lock(mutex_);
+    assert(!tasks_);
+    tasks_ = &tasks;
+    next_task_ = 0;
+    unfinished_count_ = tasks.size();
+    error_.clear();
+    if (tasks.size() > 1)
+	work_cond_.notify_all();
+
+    // Lend a hand, then wait for the other workers to finish
+    run_tasks(lock, 0);
+    while (unfinished_count_ != 0)
+	done_cond_.wait(lock);
+    tasks_ = 0;
+
+    if (!error_.empty())
+	throw std::runtime_error(error_);
+}
+
+void worker_pool::run_worker(unsigned index)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    for (;;)
+    {
+	while (!stopping_ && !(tasks_ && next_task_ != tasks_->size()))
+	    work_cond_.wait(lock);
+	if (stopping_)
+	    break;
+	run_tasks(lock, index);
+    }
+}
+
+void worker_pool::run_tasks(boost::mutex::scoped_lock & lock, unsigned index)
+{
+    while (tasks_ && next_task_ != tasks_->size())
+    {
+	const task & current = (*tasks_)[next_task_++];
+	std::string error;
+
+	lock.unlock();
+	try
+	{
+	    current(index);
+	}
+	catch (std::exception & e)
+	{
+	    error = e.what();
+	}
+	lock.lock();
+
+	if (!error.empty() && error_.empty())
+	    error_ = error;
+	if (--unfinished_count_ == 0)
+	    done_cond_.notify_one();
+    }
+}
+
+unsigned get_cpu_thread_count(unsigned limit)
+{
+    return std::min<long>(limit, std::max<long>(sysconf(_SC_NPROCESSORS_ONLN), 1));
+}
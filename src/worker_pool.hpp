@@ -0,0 +1,63 @@
+// See the file "COPYING" for licence details.
+
+// Fixed pool of worker threads for data-parallel work
+
+#ifndef DVSWITCH_WORKER_POOL_HPP
+#define DVSWITCH_WORKER_POOL_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+// The pool runs batches of tasks and waits for each batch to
+// complete.  The thread that submits a batch also runs tasks from it,
+// so a pool created with a thread count of 0 runs everything in the
+// calling thread.  Only one thread may submit batches.
+
+class worker_pool
+{
+public:
+    // A task is passed the index of the worker running it (less than
+    // size()), so that it can use per-worker resources such as codec
+    // contexts.
+    typedef boost::function<void (unsigned)> task;
+
+    explicit worker_pool(unsigned thread_count);
+    ~worker_pool();
+
+    // Number of workers, including the submitting thread
+    unsigned size() const { return threads_.size() + 1; }
+
+    // Run all the given tasks and wait for them to finish.  If any
+    // task throws an exception, this throws std::runtime_error after
+    // all the tasks have finished.
+    void run(const std::vector<task> &);
+
+private:
+    worker_pool(const worker_pool &);
+    worker_pool & operator=(const worker_pool &);
+
+    void stop();
+    void run_worker(unsigned index);
+    void run_tasks(boost::mutex::scoped_lock &, unsigned index);
+
+    boost::mutex mutex_; // controls access to the following
+    const std::vector<task> * tasks_;
+    std::size_t next_task_, unfinished_count_;
+    std::string error_;
+    bool stopping_;
+    boost::condition work_cond_, done_cond_;
+
+    std::vector<boost::thread *> threads_;
+};
+
+// Return the number of threads to use for a CPU-bound job, given the
+// number of processors online, up to the given limit
+unsigned get_cpu_thread_count(unsigned limit);
+
+#endif // !defined(DVSWITCH_WORKER_POOL_HPP)
@@ -0,0 +1,88 @@
+// See the file "COPYING" for licence details.
+
+#ifdef NDEBUG
+#error "This is a test program and requires assertions to be enabled."
+#endif
+
+#include <cassert>
+#include <cstring>
+
+#include "audio_resampler.hpp"
+
+namespace
+{
+    const unsigned frame_count = 1920;
+    const unsigned max_frame_count = 1944;
+    const unsigned tick_count = 100;
+
+    pcm_sample input[audio_resampler::max_tracked_puts]
+                    [PCM_CHANNELS * frame_count];
+    pcm_sample output[PCM_CHANNELS * frame_count];
+
+    void fill_input(unsigned tick)
+    {
+	pcm_sample * samples = input[tick % audio_resampler::max_tracked_puts];
+	for (unsigned i = 0; i != PCM_CHANNELS * frame_count; ++i)
+	    samples[i] = pcm_sample(tick * 1000 + i);
+    }
+}
+
+int main()
+{
+    audio_resampler resampler;
+    unsigned serial;
+
+    assert(!resampler.get(output, frame_count, 1.0));
+    assert(!resampler.get_passed_through(serial));
+
+    // Input and output at the same rate: after the initial silence,
+    // every put is read out unchanged
+    resampler.reset(max_frame_count + max_frame_count / 2);
+    for (unsigned tick = 0; tick != tick_count; ++tick)
+    {
+	fill_input(tick);
+	assert(resampler.put(input[tick % audio_resampler::max_tracked_puts],
+			     frame_count)
+	       == tick);
+	assert(resampler.get(output, frame_count, 1.0));
+	if (tick >= 2)
+	{
+	    assert(resampler.get_passed_through(serial));
+	    assert(serial == tick - 2);
+	    assert(!std::memcmp(output,
+				input[serial % audio_resampler::max_tracked_puts],
+				sizeof(output)));
+	}
+	assert(resampler.fill() >= max_frame_count);
+    }
+
+    // A missing put is covered by the buffer, after which the
+    // output is resampled until the buffer is refilled and lines up
+    // with a put again
+    assert(resampler.get(output, frame_count, 1.0));
+    assert(!resampler.get_passed_through(serial));
+    assert(resampler.fill() != 0);
+    bool passed_through = false;
+    for (unsigned tick = tick_count; tick != 4 * tick_count; ++tick)
+    {
+	fill_input(tick);
+	resampler.put(input[tick % audio_resampler::max_tracked_puts],
+		      frame_count);
+	assert(resampler.get(output, frame_count, 1.0));
+	if (resampler.get_passed_through(serial))
+	{
+	    assert(!std::memcmp(output,
+				input[serial % audio_resampler::max_tracked_puts],
+				sizeof(output)));
+	    passed_through = true;
+	}
+	else
+	{
+	    assert(!passed_through);
+	}
+    }
+    assert(passed_through);
+    assert(resampler.fill() >= max_frame_count);
+
+    return 0;
+}
@@ -0,0 +1,322 @@
+// See the file "COPYING" for licence details.
+
+#ifdef NDEBUG
+#error "This is a test program and requires assertions to be enabled."
+#endif
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "dif.h"
+
+namespace
+{
+    // The original per-sample companding and (de)shuffling, which the
+    // table-driven implementations must match
+
+    unsigned reference_12bit_scale(uint16_t sample)
+    {
+	unsigned result = 0;
+
+	if (sample & 0x7000)
+	{
+	    sample >>= 4;
+	    result += 4;
+	}
+	if (sample & 0x0c00)
+	{
+	    sample >>= 2;
+	    result += 2;
+	}
+	if (sample & 0x0200)
+	    result += 1;
+	return result;
+    }
+
+    pcm_sample reference_decode_12bit(unsigned code)
+    {
+	if (code < 0x200)
+	{
+	    return code;
+	}
+	else if (code < 0x800)
+	{
+	    unsigned scale = (code >> 8) - 1;
+	    return ((code & 0xff) + 0x100) << scale;
+	}
+	else if (code == 0x800)
+	{
+	    return 0;
+	}
+	else if (code < 0xe00)
+	{
+	    unsigned scale = 14 - (code >> 8);
+	    return ((int)(code & 0xff) - 0x200) << scale;
+	}
+	else
+	{
+	    return (int)code - 0x1000;
+	}
+    }
+
+    unsigned reference_encode_12bit(pcm_sample sample)
+    {
+	if (sample >= -0x200 && sample <= 0x200)
+	{
+	    return (unsigned)sample & 0xfff;
+	}
+	else if (sample > 0)
+	{
+	    unsigned scale = reference_12bit_scale(sample);
+	    return ((scale + 1) << 8) | ((sample >> scale) & 0xff);
+	}
+	else
+	{
+	    unsigned scale = reference_12bit_scale(~sample);
+	    return ((14 - scale) << 8) | ((((sample - 1) >> scale) + 1) & 0xff);
+	}
+    }
+
+    uint8_t * audio_block_data(uint8_t * buffer, unsigned seq,
+			       unsigned block_n)
+    {
+	return (buffer + seq * DIF_SEQUENCE_SIZE
+		+ (6 + 16 * block_n) * DIF_BLOCK_SIZE
+		+ DIF_BLOCK_ID_SIZE + DIF_PACK_SIZE);
+    }
+
+    void reference_get_audio(const uint8_t * buffer, unsigned frame_count,
+			     unsigned quant, pcm_sample * samples)
+    {
+	const struct dv_system * system = dv_buffer_system(buffer);
+	unsigned sample_count = PCM_CHANNELS * frame_count;
+
+	for (unsigned seq = 0;
+	     seq != (quant ? system->seq_count / 2 : system->seq_count);
+	     ++seq)
+	{
+	    for (unsigned block_n = 0; block_n != 9; ++block_n)
+	    {
+		const uint8_t * block = audio_block_data(
+		    const_cast<uint8_t *>(buffer), seq, block_n);
+
+		if (quant) // 12-bit
+		{
+		    for (unsigned i = 0; i != 24; ++i)
+		    {
+			unsigned pos = (system->audio_shuffle[seq][block_n] +
+					i * system->seq_count * 9);
+			if (pos < sample_count)
+			{
+			    unsigned code = ((block[3 * i] << 4) +
+					     (block[3 * i + 2] >> 4));
+			    samples[pos] = reference_decode_12bit(code);
+			}
+
+			pos = (system->audio_shuffle[
+				   seq + system->seq_count / 2][block_n] +
+			       i * system->seq_count * 9);
+			if (pos < sample_count)
+			{
+			    unsigned code = ((block[3 * i + 1] << 4) +
+					     (block[3 * i + 2] & 0xf));
+			    samples[pos] = reference_decode_12bit(code);
+			}
+		    }
+		}
+		else // 16-bit
+		{
+		    for (unsigned i = 0; i != 36; ++i)
+		    {
+			unsigned pos = (system->audio_shuffle[seq][block_n] +
+					i * system->seq_count * 9);
+			if (pos < sample_count)
+			{
+			    pcm_sample sample = (block[2 * i + 1] +
+						 (block[2 * i] << 8));
+			    if (sample == -0x8000)
+				sample = 0;
+			    samples[pos] = sample;
+			}
+		    }
+		}
+	    }
+	}
+    }
+
+    // Write only the sample data of the audio blocks
+    void reference_set_audio_data(uint8_t * buffer, unsigned frame_count,
+				  unsigned quant, const pcm_sample * samples)
+    {
+	const struct dv_system * system = dv_buffer_system(buffer);
+	unsigned sample_count = PCM_CHANNELS * frame_count;
+
+	for (unsigned seq = 0; seq != system->seq_count; ++seq)
+	{
+	    if (quant && seq == system->seq_count / 2)
+		samples = NULL; // silence extra 2 channels
+
+	    for (unsigned block_n = 0; block_n != 9; ++block_n)
+	    {
+		uint8_t * out = audio_block_data(buffer, seq, block_n);
+
+		if (samples == NULL)
+		{
+		    std::memset(out, 0, DIF_BLOCK_SIZE - DIF_BLOCK_ID_SIZE
+				- DIF_PACK_SIZE);
+		}
+		else if (quant) // 12-bit
+		{
+		    for (unsigned i = 0; i != 24; ++i)
+		    {
+			unsigned pos = (system->audio_shuffle[seq][block_n] +
+					i * system->seq_count * 9);
+			unsigned code1 = (pos < sample_count)
+			    ? reference_encode_12bit(samples[pos]) : 0;
+			pos = (system->audio_shuffle[
+				   seq + system->seq_count / 2][block_n] +
+			       i * system->seq_count * 9);
+			unsigned code2 = (pos < sample_count)
+			    ? reference_encode_12bit(samples[pos]) : 0;
+
+			*out++ = code1 >> 4;
+			*out++ = code2 >> 4;
+			*out++ = (code1 << 4) | (code2 & 0xf);
+		    }
+		}
+		else // 16-bit
+		{
+		    for (unsigned i = 0; i != 36; ++i)
+		    {
+			unsigned pos = (system->audio_shuffle[seq][block_n] +
+					i * system->seq_count * 9);
+			pcm_sample sample =
+			    (pos < sample_count) ? samples[pos] : 0;
+
+			*out++ = sample >> 8;
+			*out++ = sample & 0xff;
+		    }
+		}
+	    }
+	}
+    }
+
+    const unsigned iterations = 50;
+
+    // Maximum number of samples in a frame
+    const unsigned max_sample_count = 12 * 9 * 36;
+
+    void test_system_rate(const struct dv_system * system,
+			  enum dv_sample_rate sample_rate_code)
+    {
+	static uint8_t frame[DIF_MAX_FRAME_SIZE], expected[DIF_MAX_FRAME_SIZE];
+	pcm_sample samples[max_sample_count];
+	pcm_sample result[max_sample_count], expected_result[max_sample_count];
+	const unsigned quant = sample_rate_code == dv_sample_rate_32k;
+	const unsigned min_count =
+	    system->audio_frame_counts[sample_rate_code].min;
+	const unsigned max_count =
+	    system->audio_frame_counts[sample_rate_code].max;
+
+	for (unsigned iter = 0; iter != iterations; ++iter)
+	{
+	    unsigned frame_count =
+		min_count + std::rand() % (max_count - min_count + 1);
+	    for (unsigned i = 0; i != max_sample_count; ++i)
+		samples[i] = std::rand();
+	    samples[0] = -0x8000;
+	    samples[1] = 0x7fff;
+
+	    // Multiplexing matches the reference, and leaves the rest
+	    // of the frame alone
+	    dv_buffer_fill_dummy(frame, system);
+	    dv_buffer_set_audio(frame, sample_rate_code, frame_count, samples);
+	    std::memcpy(expected, frame, system->size);
+	    reference_set_audio_data(expected, frame_count, quant, samples);
+	    assert(!std::memcmp(frame, expected, system->size));
+	    assert(dv_buffer_get_sample_rate(frame) == sample_rate_code);
+
+	    // Demultiplexing matches the reference and round-trips
+	    std::memset(result, 0x55, sizeof(result));
+	    assert(dv_buffer_get_audio(frame, result) == frame_count);
+	    std::memset(expected_result, 0x55, sizeof(expected_result));
+	    reference_get_audio(frame, frame_count, quant, expected_result);
+	    assert(!std::memcmp(result, expected_result, sizeof(result)));
+	    for (unsigned i = 0; i != PCM_CHANNELS * frame_count; ++i)
+	    {
+		pcm_sample sample = quant
+		    ? reference_decode_12bit(reference_encode_12bit(samples[i]))
+		    : (samples[i] == -0x8000) ? 0 : samples[i];
+		if (result[i] != sample)
+		{
+		    std::cerr << "mismatch for " << system->common_name
+			      << " quant " << quant << " at " << i
+			      << ": expected " << sample
+			      << " found " << result[i] << "\n";
+		    assert(false);
+		}
+	    }
+
+	    // Demultiplexing arbitrary data, including 12-bit codes
+	    // that the encoder never produces, matches the reference
+	    for (unsigned seq = 0; seq != system->seq_count; ++seq)
+		for (unsigned block_n = 0; block_n != 9; ++block_n)
+		{
+		    uint8_t * data = audio_block_data(frame, seq, block_n);
+		    for (unsigned i = 0;
+			 i != DIF_BLOCK_SIZE - DIF_BLOCK_ID_SIZE - DIF_PACK_SIZE;
+			 ++i)
+			data[i] = std::rand();
+		}
+	    std::memset(result, 0x55, sizeof(result));
+	    assert(dv_buffer_get_audio(frame, result) == frame_count);
+	    std::memset(expected_result, 0x55, sizeof(expected_result));
+	    reference_get_audio(frame, frame_count, quant, expected_result);
+	    assert(!std::memcmp(result, expected_result, sizeof(result)));
+
+	    // Silence matches the reference
+	    dv_buffer_set_audio(frame, sample_rate_code, frame_count, NULL);
+	    std::memcpy(expected, frame, system->size);
+	    reference_set_audio_data(expected, frame_count, quant, NULL);
+	    assert(!std::memcmp(frame, expected, system->size));
+	}
+    }
+
+    // Compand every possible sample value
+    void test_all_12bit_samples()
+    {
+	static uint8_t frame[DIF_MAX_FRAME_SIZE];
+	const struct dv_system * system = &dv_system_625_50;
+	const unsigned frame_count =
+	    system->audio_frame_counts[dv_sample_rate_32k].max;
+	pcm_sample samples[max_sample_count], result[max_sample_count];
+
+	dv_buffer_fill_dummy(frame, system);
+
+	for (unsigned base = 0; base < 0x10000;
+	     base += PCM_CHANNELS * frame_count)
+	{
+	    for (unsigned i = 0; i != PCM_CHANNELS * frame_count; ++i)
+		samples[i] = pcm_sample(base + i);
+	    dv_buffer_set_audio(frame, dv_sample_rate_32k, frame_count,
+				samples);
+	    assert(dv_buffer_get_audio(frame, result) == frame_count);
+	    for (unsigned i = 0; i != PCM_CHANNELS * frame_count; ++i)
+		assert(result[i] == reference_decode_12bit(
+			   reference_encode_12bit(samples[i])));
+	}
+    }
+}
+
+int main()
+{
+    test_all_12bit_samples();
+    for (int rate = 0; rate != dv_sample_rate_count; ++rate)
+    {
+	test_system_rate(&dv_system_525_60, dv_sample_rate(rate));
+	test_system_rate(&dv_system_625_50, dv_sample_rate(rate));
+    }
+    return 0;
+}
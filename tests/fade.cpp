@@ -0,0 +1,190 @@
+// See the file "COPYING" for licence details.
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <sys/time.h>
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+#include "avcodec_wrap.h"
+#include "video_effect.h"
+
+const struct
+{
+    video_effect_simd simd;
+    const char * name;
+} simds[] = {
+    { video_effect_simd_none, "none" },
+    { video_effect_simd_sse2, "sse2" },
+    { video_effect_simd_avx2, "avx2" },
+    { video_effect_simd_neon, "neon" }
+};
+const int n_simds = sizeof(simds) / sizeof(simds[0]);
+
+#ifdef TEST_SPEED
+const int heights[] = { 480, 576 };
+const int iterations = 1000;
+#else
+const int heights[] = { 1, 2, 3, 16, 480, 576 };
+#endif
+const int n_heights = sizeof(heights) / sizeof(heights[0]);
+
+// Frames are always FRAME_WIDTH wide, but have a different line size
+// so we can check the padding is left alone
+const int pad = 19;
+
+raw_frame_ref alloc_frame(PixelFormat pix_fmt, int height)
+{
+    int chroma_shift_horiz, chroma_shift_vert;
+    av_pix_fmt_get_chroma_sub_sample(pix_fmt,
+                                     &chroma_shift_horiz, &chroma_shift_vert);
+
+    raw_frame_ref frame;
+    for (int i = 0; i != 3; ++i)
+    {
+	int plane_width = (i == 0) ? FRAME_WIDTH
+	    : FRAME_WIDTH >> chroma_shift_horiz;
+	int plane_height = (i == 0) ? height : height >> chroma_shift_vert;
+	frame.planes.linesize[i] = plane_width + pad;
+	frame.planes.data[i] =
+	    new uint8_t[frame.planes.linesize[i] * plane_height];
+    }
+    frame.planes.data[3] = 0;
+    frame.planes.linesize[3] = 0;
+    frame.pix_fmt = pix_fmt;
+    frame.height = height;
+    return frame;
+}
+
+void free_frame(raw_frame_ref frame)
+{
+    for (int i = 0; i != 3; ++i)
+	delete[] frame.planes.data[i];
+}
+
+std::size_t plane_size(raw_frame_ref frame, int i)
+{
+    int chroma_shift_horiz, chroma_shift_vert;
+    av_pix_fmt_get_chroma_sub_sample(frame.pix_fmt,
+                                     &chroma_shift_horiz, &chroma_shift_vert);
+    return frame.planes.linesize[i]
+	* ((i == 0) ? frame.height : frame.height >> chroma_shift_vert);
+}
+
+void fill_random(raw_frame_ref frame)
+{
+    for (int i = 0; i != 3; ++i)
+    {
+	std::size_t size = plane_size(frame, i);
+	for (std::size_t j = 0; j != size; ++j)
+	    frame.planes.data[i][j] = std::rand();
+    }
+}
+
+void copy_frame(raw_frame_ref dest, raw_frame_ref source)
+{
+    for (int i = 0; i != 3; ++i)
+	std::memcpy(dest.planes.data[i], source.planes.data[i],
+		    plane_size(source, i));
+}
+
+// The original scalar fade, which all implementations must match
+void reference_fade(raw_frame_ref dest, raw_frame_ref sec, uint8_t scale)
+{
+    int chroma_shift_horiz, chroma_shift_vert;
+    av_pix_fmt_get_chroma_sub_sample(dest.pix_fmt,
+                                     &chroma_shift_horiz, &chroma_shift_vert);
+
+    int width = FRAME_WIDTH, height = dest.height;
+    for (int i = 0; i != 3; ++i)
+    {
+	if (i == 1)
+	{
+	    width >>= chroma_shift_horiz;
+	    height >>= chroma_shift_vert;
+	}
+	for (int y = 0; y != height; ++y)
+	{
+	    uint8_t * ptr_d = dest.planes.data[i] + dest.planes.linesize[i] * y;
+	    const uint8_t * ptr_s =
+		sec.planes.data[i] + sec.planes.linesize[i] * y;
+	    for (int x = 0; x != width; ++x)
+	    {
+		uint16_t tmp = scale * (ptr_s[x] - ptr_d[x]);
+		ptr_d[x] += (uint8_t)(tmp >> 8);
+	    }
+	}
+    }
+}
+
+void test_format_height(PixelFormat pix_fmt, int height)
+{
+    raw_frame_ref orig = alloc_frame(pix_fmt, height);
+    raw_frame_ref sec = alloc_frame(pix_fmt, height);
+    raw_frame_ref expected = alloc_frame(pix_fmt, height);
+    raw_frame_ref dest = alloc_frame(pix_fmt, height);
+    fill_random(orig);
+    fill_random(sec);
+
+    for (int i = 0; i != n_simds; ++i)
+    {
+	if (!video_effect_select_simd(simds[i].simd))
+	    continue;
+
+#ifdef TEST_SPEED
+	copy_frame(dest, orig);
+	timeval start, end;
+	gettimeofday(&start, 0);
+	for (int j = 0; j != iterations; ++j)
+	    video_effect_fade(dest, sec, j & 0xff);
+	gettimeofday(&end, 0);
+	double seconds = (end.tv_sec - start.tv_sec)
+	    + (end.tv_usec - start.tv_usec) / 1e6;
+	std::cout << simds[i].name << " "
+		  << (pix_fmt == PIX_FMT_YUV420P ? "4:2:0" : "4:1:1") << " "
+		  << FRAME_WIDTH << "x" << height
+		  << ": " << FRAME_WIDTH * height * iterations / seconds / 1e6
+		  << " Mpixel/s\n";
+#else
+	for (unsigned scale = 0; scale <= 0xff; scale += 17)
+	{
+	    copy_frame(expected, orig);
+	    reference_fade(expected, sec, scale);
+	    copy_frame(dest, orig);
+	    video_effect_fade(dest, sec, scale);
+	    for (int j = 0; j != 3; ++j)
+	    {
+		if (std::memcmp(dest.planes.data[j], expected.planes.data[j],
+				plane_size(dest, j)))
+		{
+		    std::cerr << "mismatch with " << simds[i].name
+			      << " in plane " << j << " height " << height
+			      << " scale " << scale << "\n";
+		    assert(false);
+		}
+	    }
+	}
+#endif
+    }
+
+    video_effect_select_simd(video_effect_simd_auto);
+
+    free_frame(orig);
+    free_frame(sec);
+    free_frame(expected);
+    free_frame(dest);
+}
+
+int main()
+{
+    for (int i = 0; i != n_heights; ++i)
+    {
+	test_format_height(PIX_FMT_YUV420P, heights[i]);
+	test_format_height(PIX_FMT_YUV411P, heights[i]);
+    }
+}
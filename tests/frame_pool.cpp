@@ -0,0 +1,104 @@
+#ifdef NDEBUG
+#error "This is a test program and requires assertions to be enabled."
+#endif
+
+#include <cassert>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "frame.h"
+#include "frame_pool.hpp"
+
+namespace
+{
+    std::vector<pcm_packet_ptr> helper_packets;
+    pcm_packet_ptr helper_held_packet;
+    bool helper_ready, helper_stop; // updated atomically
+
+    // Release packets into this thread's cache, then release one
+    // more after the main thread has started waiting for a buffer
+    void * run_helper(void *)
+    {
+	helper_packets.clear();
+	__atomic_store_n(&helper_ready, true, __ATOMIC_RELEASE);
+	const timespec delay = { 0, 50000000 };
+	nanosleep(&delay, 0);
+	helper_held_packet.reset();
+	// Keep the cache alive until the main thread is done
+	while (!__atomic_load_n(&helper_stop, __ATOMIC_ACQUIRE))
+	    sched_yield();
+	return 0;
+    }
+}
+
+int main()
+{
+    frame_pool_settings settings;
+    settings.capacity = 16;
+    settings.max_wait_ms = 10;
+    configure_frame_pool(frame_pool_dv_frame, settings);
+
+    std::vector<dv_frame_ptr> frames;
+    for (unsigned i = 0; i != 16; ++i)
+    {
+	frames.push_back(try_allocate_dv_frame());
+	assert(frames.back());
+    }
+    assert(!try_allocate_dv_frame());
+
+    frame_pool_stats stats = get_frame_pool_stats(frame_pool_dv_frame);
+    assert(stats.capacity == 16);
+    assert(stats.in_use == 16);
+    assert(stats.high_water == 16);
+    assert(stats.allocations == 16);
+    assert(stats.failures == 1);
+
+    // Freed buffers are reused
+    dv_frame * buffer = frames.back().get();
+    frames.pop_back();
+    frames.push_back(try_allocate_dv_frame());
+    assert(frames.back().get() == buffer);
+
+    // Waiting allocation overflows to the heap
+    dv_frame_ptr extra = allocate_dv_frame();
+    assert(extra);
+    stats = get_frame_pool_stats(frame_pool_dv_frame);
+    assert(stats.in_use == 17);
+    assert(stats.high_water == 17);
+    assert(stats.failures == 2);
+    assert(stats.max_latency_ns >= 10000000);
+    extra.reset();
+
+    frames.clear();
+    stats = get_frame_pool_stats(frame_pool_dv_frame);
+    assert(stats.in_use == 0);
+    assert(stats.high_water == 17);
+
+    // Buffers cached by another thread are reclaimed by a waiting
+    // allocation
+    settings.capacity = 128;
+    settings.max_wait_ms = 1000;
+    configure_frame_pool(frame_pool_pcm_packet, settings);
+    std::vector<pcm_packet_ptr> packets;
+    for (unsigned i = 0; i != 128; ++i)
+	packets.push_back(allocate_pcm_packet());
+    helper_packets.assign(packets.begin(), packets.begin() + 10);
+    helper_held_packet = packets[10];
+    packets.erase(packets.begin(), packets.begin() + 11);
+    pthread_t helper;
+    assert(pthread_create(&helper, 0, run_helper, 0) == 0);
+    while (!__atomic_load_n(&helper_ready, __ATOMIC_ACQUIRE))
+	sched_yield();
+    packets.push_back(allocate_pcm_packet());
+    stats = get_frame_pool_stats(frame_pool_pcm_packet);
+    assert(stats.in_use == 118);
+    assert(stats.high_water == 128);
+    assert(stats.failures == 0);
+    __atomic_store_n(&helper_stop, true, __ATOMIC_RELEASE);
+    assert(pthread_join(helper, 0) == 0);
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+// See the file "COPYING" for licence details.
+
+// Check that mix data is swapped, not copied, between pipeline stages
+
+#ifdef NDEBUG
+#error "This is a test program and requires assertions to be enabled."
+#endif
+
+#include <cassert>
+
+#include "frame.h"
+#include "frame_pool.hpp"
+#include "mixer.hpp"
+#include "ring_buffer.hpp"
+
+struct mixer_test_access
+{
+    typedef mixer::mix_data mix_data;
+    typedef mixer::mix_result mix_result;
+};
+
+namespace
+{
+    typedef mixer_test_access::mix_data mix_data;
+    typedef mixer_test_access::mix_result mix_result;
+
+    unsigned get_ref_count(const dv_frame_ptr & frame)
+    {
+	return get_frame_pool_header(frame.get())->ref_count;
+    }
+
+    void fill_data(mix_data & data, const dv_frame_ptr & frame)
+    {
+	data.source_frames.assign(3, frame);
+	data.source_raw_frames.resize(3);
+	data.source_rates.resize(3);
+	data.skipped_frames.resize(1);
+	data.skipped_frames[0].id = 1;
+	data.skipped_frames[0].frame = frame;
+    }
+
+    // The vectors' buffers must be exchanged, and the frame's
+    // reference count never changed
+    void check_data(const mix_data & data, const mix_data & orig,
+		    const dv_frame_ptr * frames, const raw_frame_ptr * raw_frames,
+		    const double * rates, const mix_data::skipped_frame * skipped)
+    {
+	assert(&data.source_frames[0] == frames);
+	assert(&data.source_raw_frames[0] == raw_frames);
+	assert(&data.source_rates[0] == rates);
+	assert(&data.skipped_frames[0] == skipped);
+	assert(orig.source_frames.empty());
+	assert(orig.source_raw_frames.empty());
+	assert(orig.source_rates.empty());
+	assert(orig.skipped_frames.empty());
+    }
+}
+
+int main()
+{
+    dv_frame_ptr frame(allocate_dv_frame());
+
+    {
+	spsc_ring_buffer<mix_data> queue(2);
+	mix_data data, out;
+	fill_data(data, frame);
+	assert(get_ref_count(frame) == 5);
+	const dv_frame_ptr * frames = &data.source_frames[0];
+	const raw_frame_ptr * raw_frames = &data.source_raw_frames[0];
+	const double * rates = &data.source_rates[0];
+	const mix_data::skipped_frame * skipped = &data.skipped_frames[0];
+
+	assert(queue.push_swap(data));
+	assert(queue.pop_swap(out));
+	check_data(out, data, frames, raw_frames, rates, skipped);
+	assert(get_ref_count(frame) == 5);
+    }
+    assert(get_ref_count(frame) == 1);
+
+    {
+	spsc_ring_buffer<mix_result> queue(2);
+	mix_result result, out;
+	fill_data(result.data, frame);
+	result.serial_num = 42;
+	result.mixed_dv = frame;
+	assert(get_ref_count(frame) == 6);
+	const dv_frame_ptr * frames = &result.data.source_frames[0];
+	const raw_frame_ptr * raw_frames = &result.data.source_raw_frames[0];
+	const double * rates = &result.data.source_rates[0];
+	const mix_data::skipped_frame * skipped =
+	    &result.data.skipped_frames[0];
+
+	assert(queue.push_swap(result));
+	assert(queue.pop_swap(out));
+	check_data(out.data, result.data, frames, raw_frames, rates, skipped);
+	assert(out.serial_num == 42);
+	assert(out.mixed_dv == frame && !result.mixed_dv);
+	assert(get_ref_count(frame) == 6);
+    }
+    assert(get_ref_count(frame) == 1);
+}
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 
@@ -25,6 +27,36 @@ const int dims[] = {
 #endif
 const int n_dims = sizeof(dims) / sizeof(dims[0]);
 
+#ifndef TEST_SPEED
+const struct
+{
+    video_effect_simd simd;
+    const char * name;
+} simds[] = {
+    { video_effect_simd_sse2, "sse2" },
+    { video_effect_simd_avx2, "avx2" },
+    { video_effect_simd_neon, "neon" }
+};
+const int n_simds = sizeof(simds) / sizeof(simds[0]);
+
+// Source sizes for the comparison of SIMD and C implementations,
+// covering each of the special column ratios and general scaling
+const struct
+{
+    int width, height;
+} simd_source_dims[] = {
+    { 720, 576 }, { 360, 288 }, { 240, 192 }, { 180, 144 },
+    { 712, 480 }, { 33, 17 }, { 256, 64 }
+};
+const int n_simd_source_dims =
+    sizeof(simd_source_dims) / sizeof(simd_source_dims[0]);
+
+// Heights of the bands that the effect is split into; 0 means the
+// whole frame
+const int band_heights[] = { 0, 2, 16, 100, 288 };
+const int n_band_heights = sizeof(band_heights) / sizeof(band_heights[0]);
+#endif
+
 void alloc_plane(raw_frame_ref & frame, int i, int width, int height)
 {
     size_t size = (width + 2 * pad) * (height + 2 * pad);
@@ -270,12 +302,138 @@ void test_format(PixelFormat pix_fmt)
     }
 }
 
+#ifndef TEST_SPEED
+
+std::size_t plane_buf_size(raw_frame_ref frame, int i, int height)
+{
+    int chroma_shift_horiz, chroma_shift_vert;
+    av_pix_fmt_get_chroma_sub_sample(frame.pix_fmt,
+                                     &chroma_shift_horiz, &chroma_shift_vert);
+    return frame.planes.linesize[i]
+	* (((i == 0) ? height : height >> chroma_shift_vert) + 2 * pad);
+}
+
+uint8_t * plane_buf(raw_frame_ref frame, int i)
+{
+    return frame.planes.data[i] - frame.planes.linesize[i] * pad - pad;
+}
+
+void fill_random(raw_frame_ref frame, int height)
+{
+    for (int i = 0; i != 3; ++i)
+    {
+	std::size_t size = plane_buf_size(frame, i, height);
+	uint8_t * buf = plane_buf(frame, i);
+	for (std::size_t j = 0; j != size; ++j)
+	    buf[j] = std::rand();
+    }
+}
+
+void copy_frame(raw_frame_ref dest, raw_frame_ref source, int height)
+{
+    for (int i = 0; i != 3; ++i)
+	std::memcpy(plane_buf(dest, i), plane_buf(source, i),
+		    plane_buf_size(source, i, height));
+}
+
+// Compare every SIMD implementation with the C implementation, using
+// random content and splitting the effect into bands of various
+// heights
+void test_simd_format(PixelFormat pix_fmt)
+{
+    int chroma_shift_horiz, chroma_shift_vert;
+    av_pix_fmt_get_chroma_sub_sample(pix_fmt,
+                                     &chroma_shift_horiz, &chroma_shift_vert);
+
+    const int d_width = FRAME_WIDTH, d_height = FRAME_HEIGHT_MAX;
+    raw_frame_ref orig = alloc_frame(pix_fmt, d_width, d_height);
+    raw_frame_ref expected = alloc_frame(pix_fmt, d_width, d_height);
+    raw_frame_ref dest = alloc_frame(pix_fmt, d_width, d_height);
+    fill_random(orig, d_height);
+
+    for (int i = 0; i != n_simd_source_dims; ++i)
+    {
+	const int s_width = simd_source_dims[i].width;
+	const int s_height = simd_source_dims[i].height;
+	raw_frame_ref source = alloc_frame(pix_fmt, s_width, s_height);
+	fill_random(source, s_height);
+	rectangle s_rect = { 0, 0, s_width, s_height };
+
+	// Scale down by 1, 2, 3 and 4 where the dest rectangle fits
+	for (int ratio = 1; ratio <= 4; ++ratio)
+	{
+	    rectangle d_rect;
+	    d_rect.left = (std::rand() % (d_width - s_width / ratio + 1))
+		& -(1 << chroma_shift_horiz);
+	    d_rect.right = d_rect.left
+		+ ((s_width / ratio) & -(1 << chroma_shift_horiz));
+	    d_rect.top = (std::rand() % (d_height - s_height / ratio + 1))
+		& -(1 << chroma_shift_vert);
+	    d_rect.bottom = d_rect.top
+		+ ((s_height / ratio) & -(1 << chroma_shift_vert));
+	    if (d_rect.right == d_rect.left || d_rect.bottom == d_rect.top)
+		continue;
+
+	    video_effect_select_simd(video_effect_simd_none);
+	    copy_frame(expected, orig, d_height);
+	    video_effect_pic_in_pic(expected, d_rect, source, s_rect);
+
+	    for (int j = 0; j != n_simds; ++j)
+	    {
+		if (!video_effect_select_simd(simds[j].simd))
+		    continue;
+
+		for (int k = 0; k != n_band_heights; ++k)
+		{
+		    int band_height = band_heights[k] ? band_heights[k] : d_height;
+		    copy_frame(dest, orig, d_height);
+		    for (int band_top = 0; band_top < d_height;
+			 band_top += band_height)
+			video_effect_pic_in_pic_band(
+			    dest, d_rect, source, s_rect, band_top,
+			    std::min(band_top + band_height, d_height));
+
+		    for (int plane = 0; plane != 3; ++plane)
+		    {
+			if (std::memcmp(plane_buf(dest, plane),
+					plane_buf(expected, plane),
+					plane_buf_size(dest, plane, d_height)))
+			{
+			    std::cerr << "mismatch with " << simds[j].name
+				      << " in plane " << plane
+				      << " source " << s_width << "x" << s_height
+				      << " dest " << d_rect.right - d_rect.left
+				      << "x" << d_rect.bottom - d_rect.top
+				      << " band height " << band_height << "\n";
+			    assert(false);
+			}
+		    }
+		}
+	    }
+	}
+
+	free_frame(source);
+    }
+
+    video_effect_select_simd(video_effect_simd_auto);
+
+    free_frame(orig);
+    free_frame(expected);
+    free_frame(dest);
+}
+
+#endif // !TEST_SPEED
+
 int main()
 {
 #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(53, 5, 0)
     avcodec_init();
 #endif
     avcodec_register_all();
+#ifndef TEST_SPEED
+    test_simd_format(PIX_FMT_YUV420P);
+    test_simd_format(PIX_FMT_YUV411P);
+#endif
     test_format(PIX_FMT_YUV420P);
     test_format(PIX_FMT_YUV411P);
 }
@@ -2,8 +2,34 @@
 #error "This is a test program and requires assertions to be enabled."
 #endif
 
+#include <algorithm>
+
 #include "ring_buffer.hpp"
 
+namespace
+{
+    // Value that counts how often it is copied
+    struct counted
+    {
+	counted() : value(0) {}
+	counted(const counted & other) : value(other.value) { ++copies; }
+	counted & operator=(const counted & other)
+	{
+	    value = other.value;
+	    ++copies;
+	    return *this;
+	}
+	int value;
+	static unsigned copies;
+    };
+    unsigned counted::copies = 0;
+
+    void swap(counted & left, counted & right)
+    {
+	std::swap(left.value, right.value);
+    }
+}
+
 int main()
 {
     ring_buffer<int> buf(2);
@@ -55,4 +81,60 @@ int main()
     assert(buf3.back() == 2);
     assert(buf3.size() == 1);
     assert(!buf3.empty() && !buf3.full());
+
+    spsc_ring_buffer<int> sbuf(3);
+    assert(sbuf.capacity() == 4);
+    assert(sbuf.size() == 0);
+    assert(sbuf.empty());
+    int value;
+    assert(!sbuf.pop());
+    assert(!sbuf.pop_swap(value));
+    assert(sbuf.push(1));
+    value = 2;
+    assert(sbuf.push_swap(value));
+    assert(value == 0);
+    assert(sbuf.size() == 2);
+    assert(!sbuf.empty() && !sbuf.full());
+    assert(sbuf.push(3));
+    assert(sbuf.push(4));
+    assert(sbuf.full());
+    assert(!sbuf.push(5));
+    value = 6;
+    assert(sbuf.pop_swap(value));
+    assert(value == 1);
+    assert(sbuf.size() == 3);
+    // The slot now holds 6, which is swapped out by the next push
+    value = 7;
+    assert(sbuf.push_swap(value));
+    assert(value == 6);
+    assert(sbuf.full());
+    spsc_ring_buffer<int> sbuf2(sbuf);
+    int values[5] = { 0, 0, 0, 0, 0 };
+    assert(sbuf.pop_swap(values, 5) == 4);
+    assert(values[0] == 2 && values[1] == 3 && values[2] == 4
+	   && values[3] == 7 && values[4] == 0);
+    assert(sbuf.empty());
+    assert(sbuf.pop_swap(values, 5) == 0);
+    assert(sbuf2.size() == 4);
+    assert(sbuf2.pop());
+    assert(sbuf2.pop_swap(values, 2) == 2);
+    assert(values[0] == 3 && values[1] == 4);
+    assert(sbuf2.size() == 1);
+    sbuf = sbuf2;
+    assert(sbuf.size() == 1);
+    assert(sbuf.pop_swap(value));
+    assert(value == 7);
+
+    // Swapping values in and out must not copy them
+    spsc_ring_buffer<counted> cbuf(2);
+    counted cvalue, cvalues[2];
+    cvalue.value = 1;
+    assert(cbuf.push_swap(cvalue));
+    cvalue.value = 2;
+    assert(cbuf.push_swap(cvalue));
+    assert(cbuf.pop_swap(cvalue));
+    assert(cvalue.value == 1);
+    assert(cbuf.pop_swap(cvalues, 2) == 1);
+    assert(cvalues[0].value == 2);
+    assert(counted::copies == 0);
 }